@@ -0,0 +1,40 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace XViewMap
+{
+// T型の値を8byteごとのatomicで保持する
+// 書き込みと読み出しが重なってもデータ競合にはならない(整合性は使う側で確認する)
+template <typename T>
+class AtomicStorage
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    static constexpr std::size_t num_words = (sizeof(T) + 7) / 8;
+    std::array<std::atomic<std::uint64_t>, num_words> words{};
+
+public:
+    void store(const T& value)
+    {
+        std::array<std::uint64_t, num_words> w{};
+        std::memcpy(w.data(), &value, sizeof(T));
+        for (std::size_t i = 0; i < num_words; i++) {
+            words[i].store(w[i], std::memory_order_relaxed);
+        }
+    }
+    T load() const
+    {
+        std::array<std::uint64_t, num_words> w;
+        for (std::size_t i = 0; i < num_words; i++) {
+            w[i] = words[i].load(std::memory_order_relaxed);
+        }
+        T value;
+        std::memcpy(static_cast<void*>(&value), w.data(), sizeof(T));
+        return value;
+    }
+};
+}  // namespace XViewMap
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <utility>
+
+namespace XViewMap
+{
+// 複数のスレッドからpushし、1つのスレッドがまとめて取り出すキュー
+// pushはCASだけで行う(ノードの確保はする)
+template <typename T>
+class MpscQueue
+{
+    struct Node {
+        T value;
+        Node* next;
+    };
+    std::atomic<Node*> head = nullptr;  // 新しいものが先頭
+
+public:
+    MpscQueue() = default;
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+    ~MpscQueue()
+    {
+        consumeAll([](T&&) {});
+    }
+
+    void push(T value)
+    {
+        Node* node = new Node{std::move(value), head.load(std::memory_order_relaxed)};
+        while (!head.compare_exchange_weak(
+            node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+    bool empty() const { return head.load(std::memory_order_acquire) == nullptr; }
+
+    // 溜まっているものをpushされた順にf(T&&)に渡す
+    template <typename F>
+    void consumeAll(F&& f)
+    {
+        Node* node = head.exchange(nullptr, std::memory_order_acquire);
+        Node* reversed = nullptr;
+        while (node) {
+            Node* next = node->next;
+            node->next = reversed;
+            reversed = node;
+            node = next;
+        }
+        while (reversed) {
+            Node* next = reversed->next;
+            f(std::move(reversed->value));
+            delete reversed;
+            reversed = next;
+        }
+    }
+};
+}  // namespace XViewMap
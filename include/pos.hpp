@@ -0,0 +1,23 @@
+#pragma once
+#include <cmath>
+
+namespace XViewMap
+{
+struct Pos {
+    double x = 0, y = 0, th = 0;
+    Pos(double x, double y, double th = 0) : x(x), y(y), th(th) {}
+    Pos() = default;
+    // 相対座標を加算
+    auto operator+(const Pos& rel) const
+    {
+        double c = cos(this->th), s = sin(this->th);
+        return Pos{
+            this->x + rel.x * c - rel.y * s, this->y + rel.y * c + rel.x * s, this->th + rel.th};
+    }
+    bool operator==(const Pos& rhs) const
+    {
+        return this->x == rhs.x && this->y == rhs.y && this->th == rhs.th;
+    }
+    bool operator!=(const Pos& rhs) const { return !(*this == rhs); }
+};
+}  // namespace XViewMap
@@ -1,8 +1,10 @@
 #pragma once
-#include <cmath>
-#include <mutex>
-#include <queue>
-#include <condition_variable>
+#include "pos.hpp"
+#include "spsc_ring.hpp"
+#include "trajectory.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <utility>
 #include <array>
@@ -10,100 +12,109 @@
 
 namespace XViewMap
 {
-struct Pos {
-    double x = 0, y = 0, th = 0;
-    Pos(double x, double y, double th = 0) : x(x), y(y), th(th) {}
-    Pos() = default;
-    // 相対座標を加算
-    auto operator+(const Pos& rel) const
-    {
-        double c = cos(this->th), s = sin(this->th);
-        return Pos{
-            this->x + rel.x * c - rel.y * s, this->y + rel.y * c + rel.x * s, this->th + rel.th};
-    }
-    bool operator==(const Pos& rhs) const
-    {
-        return this->x == rhs.x && this->y == rhs.y && this->th == rhs.th;
-    }
-    bool operator!=(const Pos& rhs) const { return !(*this == rhs); }
-};
-
 class PositionHistory
 {
 private:
-    std::mutex m;
-    std::queue<Pos> to_update_queue;
-    std::condition_variable update_cond;
-    bool terminated = false;
+    // updatePos/resetPosから描画スレッドへの受け渡し
+    // resetの印はリングが溢れたときに捨てられたり上書きされたりするので、
+    // 何回目のresetの後の点かを全部の点に付けておき、変わったところでresetする
+    struct Entry {
+        Pos pos;
+        std::uint64_t epoch;
+    };
+    SpscRing<Entry> to_update_queue;
+    std::optional<Pos> last_pushed;  // producer側だけが触る
+    std::uint64_t pushed_epoch = 0;  // producer側だけが触る
+    std::uint64_t popped_epoch = 0;  // consumer側だけが触る
+    RetentionPolicy retention;
+
+    // 間引いた軌跡(粗い方が後)
+    std::vector<SimplifiedTrajectory> lod;
 
 public:
-    std::vector<Pos> history;
+    // 以下は描画側(consumer)だけが触る
+    Trajectory history;
+    // 途中が消えたり(reset、古い分を捨てた)したときに増える
+    std::uint64_t generation = 0;
 
-    std::pair<std::optional<Pos>, Pos> waitPopLastNext()
+    // 元の軌跡からのずれがmax_error未満になる中で一番粗い軌跡
+    // (画面上で半ピクセル未満のずれなら間引いても見た目は変わらない)
+    const Trajectory& simplified(double max_error) const
     {
-        std::unique_lock lock(m);
-        while (to_update_queue.empty() && !terminated) {
-            update_cond.wait(lock);
-        }
-        if (terminated) {
-            return {};
-        }
-        Pos next = to_update_queue.front();
-        to_update_queue.pop();
-        std::optional<Pos> last = std::nullopt;
-        if (!history.empty()) {
-            last = history.back();
+        const Trajectory* best = &history;
+        for (const auto& level : lod) {
+            if (level.tolerance >= max_error) {
+                break;
+            }
+            best = &level.points;
         }
-        history.push_back(next);
-        return std::make_pair(last, next);
+        return *best;
     }
-    std::optional<Pos> getNow()
+
+    // compactにすると軌跡を0.5mm単位に丸めて小さく持つ
+    explicit PositionHistory(std::size_t queue_capacity = 4096,
+        OverflowPolicy policy = OverflowPolicy::DropOldest, RetentionPolicy retention = {},
+        bool compact = false)
+        : to_update_queue(queue_capacity, policy), retention(retention),
+          history(500, compact)
     {
-        std::lock_guard lock(m);
-        if (to_update_queue.empty()) {
-            if (history.empty()) {
-                return std::nullopt;
-            } else {
-                return history.back();
-            }
-        } else {
-            return to_update_queue.back();
+        // 1mm, 2mm, 4mm, ..., 256mm
+        for (double tolerance = 1; tolerance <= 256; tolerance *= 2) {
+            lod.emplace_back(tolerance, compact);
         }
     }
-    void push(Pos pos)
+
+    // キューに溜まっている分を全部historyに移す
+    // 戻り値はhistoryのうち新しく追加された部分の先頭の番号
+    // (途中でresetされていればそれ以前の点とは繋がない)
+    std::size_t popAll()
     {
-        {
-            std::lock_guard lock(m);
-            bool diff = false;
-            if (to_update_queue.empty()) {
-                if (history.empty()) {
-                    diff = true;
-                } else {
-                    diff = history.back() != pos;
+        std::size_t begin = history.end();
+        auto now = Trajectory::Clock::now();
+        Entry next;
+        bool popped = false;
+        while (to_update_queue.pop(next)) {
+            if (next.epoch != popped_epoch) {
+                popped_epoch = next.epoch;
+                history.clear();
+                for (auto& level : lod) {
+                    level.points.clear();
                 }
-            } else {
-                diff = to_update_queue.back() != pos;
+                generation++;
+                begin = history.end();
+            }
+            for (auto& level : lod) {
+                level.push_back(next.pos, now, history.end());
             }
-            if (diff) {
-                to_update_queue.push(pos);
+            history.push_back(next.pos, now);
+            popped = true;
+        }
+        if (popped && history.applyRetention(retention, now)) {
+            for (auto& level : lod) {
+                level.points.releaseBefore(history.begin());
             }
+            generation++;
         }
-        update_cond.notify_one();
+        return begin;
     }
-    void reset(Pos pos)
+    // キューにまだ何か残っているか
+    bool pending() const { return !to_update_queue.empty(); }
+    // 以下はproducer(1スレッド)から呼ぶ
+    // ロックもメモリ確保もしない
+    void push(Pos pos)
     {
-        {
-            std::lock_guard lock(m);
-            to_update_queue.push(pos);
-            history.clear();
+        if (!last_pushed || *last_pushed != pos) {
+            to_update_queue.push({pos, pushed_epoch});
+            last_pushed = pos;
         }
-        update_cond.notify_one();
     }
-
-    void terminate()
+    void reset(Pos pos)
     {
-        terminated = true;
-        update_cond.notify_all();
+        pushed_epoch++;
+        to_update_queue.push({pos, pushed_epoch});
+        last_pushed = pos;
     }
+    // キューが溢れて捨てた数
+    std::size_t dropped() const { return to_update_queue.dropped(); }
 };
 }  // namespace XViewMap
\ No newline at end of file
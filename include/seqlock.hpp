@@ -0,0 +1,48 @@
+#pragma once
+#include "atomic_storage.hpp"
+#include <atomic>
+#include <cstdint>
+
+namespace XViewMap
+{
+// 1スレッドが書き、他のスレッドがロック無しで読む値
+// 読む側は書き込み途中のものを読んだらやり直すので、常に1回分の書き込みがそろった値が得られる
+template <typename T>
+class SeqLock
+{
+    std::atomic<std::uint64_t> seq{0};  // 奇数の間は書き込み中
+    AtomicStorage<T> data;
+
+public:
+    SeqLock() = default;
+    explicit SeqLock(const T& value) { data.store(value); }
+
+    // 書く側(1スレッドのみ)
+    void store(const T& value)
+    {
+        std::uint64_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        data.store(value);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    // 読む側
+    T load() const
+    {
+        while (true) {
+            std::uint64_t s = seq.load(std::memory_order_acquire);
+            if (s % 2 != 0) {
+                continue;
+            }
+            T value = data.load();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == s) {
+                return value;
+            }
+        }
+    }
+    // storeするたびに変わる
+    std::uint64_t version() const { return seq.load(std::memory_order_acquire); }
+};
+}  // namespace XViewMap
@@ -0,0 +1,128 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace XViewMap
+{
+// フィールドを一定の大きさのセルに分け、各セルにかかる線分などの番号を覚えておく
+// 軌跡は連続した番号の線分が同じセルに並ぶことが多いので、番号を[begin, end)の区間でまとめて持つ
+// 範囲を指定すると、そこにかかるかもしれない番号だけが取り出せる
+class SpatialGrid
+{
+public:
+    using Run = std::pair<std::size_t, std::size_t>;  // [first, second)
+
+private:
+    double cell_size;
+    std::unordered_map<std::uint64_t, std::vector<Run>> cells;
+    // セルをたくさんまたぐ大きいものは別にしておき、毎回返す
+    std::vector<Run> large;
+    static constexpr long max_cells_per_item = 64;
+
+    long cellOf(double v) const { return static_cast<long>(std::floor(v / cell_size)); }
+    static std::uint64_t key(long cx, long cy)
+    {
+        return static_cast<std::uint64_t>(static_cast<std::uint32_t>(cx)) << 32
+               | static_cast<std::uint32_t>(cy);
+    }
+    static void append(std::vector<Run>& runs, std::size_t index)
+    {
+        if (!runs.empty() && runs.back().second == index) {
+            runs.back().second++;
+        } else {
+            runs.push_back({index, index + 1});
+        }
+    }
+
+public:
+    explicit SpatialGrid(double cell_size = 500) : cell_size(cell_size) {}
+
+    // 範囲[min, max]にindex番目があることを追加
+    // indexは前回以上の値で呼ぶ
+    void insert(double min_x, double min_y, double max_x, double max_y, std::size_t index)
+    {
+        long cx_begin = cellOf(min_x), cx_end = cellOf(max_x) + 1;
+        long cy_begin = cellOf(min_y), cy_end = cellOf(max_y) + 1;
+        if ((cx_end - cx_begin) * (cy_end - cy_begin) > max_cells_per_item) {
+            append(large, index);
+            return;
+        }
+        for (long cx = cx_begin; cx < cx_end; cx++) {
+            for (long cy = cy_begin; cy < cy_end; cy++) {
+                append(cells[key(cx, cy)], index);
+            }
+        }
+    }
+    // 範囲[min, max]にかかるかもしれない番号のうち、[begin, end)の部分
+    // 番号順に並べ、重なりは1つにまとめてrunsに入れる
+    void query(double min_x, double min_y, double max_x, double max_y, std::size_t begin,
+        std::size_t end, std::vector<Run>& runs) const
+    {
+        runs.clear();
+        auto collect = [&](const std::vector<Run>& from) {
+            // beginより後ろの区間だけを見る
+            auto it = std::lower_bound(from.begin(), from.end(), begin,
+                [](const Run& r, std::size_t b) { return r.second <= b; });
+            for (; it != from.end() && it->first < end; ++it) {
+                runs.push_back({std::max(it->first, begin), std::min(it->second, end)});
+            }
+        };
+        collect(large);
+        long cx_begin = cellOf(min_x), cx_end = cellOf(max_x) + 1;
+        long cy_begin = cellOf(min_y), cy_end = cellOf(max_y) + 1;
+        if ((cx_end - cx_begin) * (cy_end - cy_begin) > static_cast<long>(cells.size())) {
+            // セルを1つずつ探すより全部見たほうが早い
+            for (const auto& cell : cells) {
+                collect(cell.second);
+            }
+        } else {
+            for (long cx = cx_begin; cx < cx_end; cx++) {
+                for (long cy = cy_begin; cy < cy_end; cy++) {
+                    auto it = cells.find(key(cx, cy));
+                    if (it != cells.end()) {
+                        collect(it->second);
+                    }
+                }
+            }
+        }
+        std::sort(runs.begin(), runs.end());
+        std::size_t n = 0;
+        for (const Run& r : runs) {
+            if (n > 0 && r.first <= runs[n - 1].second) {
+                runs[n - 1].second = std::max(runs[n - 1].second, r.second);
+            } else {
+                runs[n++] = r;
+            }
+        }
+        runs.resize(n);
+    }
+    // beginより前の番号を忘れる
+    void prune(std::size_t begin)
+    {
+        auto drop = [&](std::vector<Run>& runs) {
+            auto it = std::lower_bound(runs.begin(), runs.end(), begin,
+                [](const Run& r, std::size_t b) { return r.second <= b; });
+            runs.erase(runs.begin(), it);
+        };
+        drop(large);
+        for (auto it = cells.begin(); it != cells.end();) {
+            drop(it->second);
+            if (it->second.empty()) {
+                it = cells.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    void clear()
+    {
+        cells.clear();
+        large.clear();
+    }
+};
+}  // namespace XViewMap
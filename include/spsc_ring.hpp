@@ -0,0 +1,137 @@
+#pragma once
+#include "atomic_storage.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace XViewMap
+{
+// リングが満杯のときの動作
+enum class OverflowPolicy {
+    DropOldest,  // 一番古いものを捨てて入れる
+    DropNewest,  // 新しく来たものを捨てる
+    Coalesce,    // 満杯の間は最新の1つだけを別に保持し、空いたら続きとして渡す
+};
+
+// 1スレッドがpush、1スレッドがpopする固定長のリングバッファ
+// pushはロック・メモリ確保・待ちを一切しない(wait-free)
+template <typename T>
+class SpscRing
+{
+    std::size_t capacity, mask;
+    std::unique_ptr<AtomicStorage<T>[]> slots;
+    OverflowPolicy policy;
+
+    alignas(64) std::atomic<std::size_t> head{0};  // 次に書く位置(producerのみ書く)
+    alignas(64) std::atomic<std::size_t> tail{0};  // 次に読む位置(DropOldestのときはproducerも進める)
+
+    // Coalesce用: seqが奇数の間は書き込み中、seq != ackの間は未読
+    alignas(64) std::atomic<std::uint64_t> latest_seq{0};
+    std::atomic<std::uint64_t> latest_ack{0};
+    AtomicStorage<T> latest;
+
+    std::atomic<std::size_t> num_dropped{0};
+
+    static std::size_t roundUpPow2(std::size_t n)
+    {
+        std::size_t p = 1;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+public:
+    explicit SpscRing(std::size_t capacity, OverflowPolicy policy = OverflowPolicy::DropOldest)
+        : capacity(roundUpPow2(capacity < 2 ? 2 : capacity)), mask(this->capacity - 1),
+          slots(new AtomicStorage<T>[this->capacity]), policy(policy)
+    {
+    }
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // producer側
+    // 何も捨てずに入れられたらtrue
+    bool push(const T& value)
+    {
+        std::size_t h = head.load(std::memory_order_relaxed);
+        if (policy == OverflowPolicy::Coalesce) {
+            std::uint64_t seq = latest_seq.load(std::memory_order_relaxed);
+            bool unread = seq != latest_ack.load(std::memory_order_acquire);
+            // 溢れた分がまだ読まれていないなら順番を守るためそちらを上書きし続ける
+            if (unread || h - tail.load(std::memory_order_acquire) >= capacity) {
+                latest_seq.store(seq + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+                latest.store(value);
+                latest_seq.store(seq + 2, std::memory_order_release);
+                if (unread) {
+                    num_dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+                return !unread;
+            }
+        } else {
+            std::size_t t = tail.load(std::memory_order_acquire);
+            if (h - t >= capacity) {
+                num_dropped.fetch_add(1, std::memory_order_relaxed);
+                if (policy == OverflowPolicy::DropNewest) {
+                    return false;
+                }
+                // 失敗したならconsumerが読んで空きができている
+                tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel);
+            }
+        }
+        slots[h & mask].store(value);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer側
+    // 取り出せたらtrue
+    bool pop(T& out)
+    {
+        while (true) {
+            std::size_t t = tail.load(std::memory_order_acquire);
+            if (t != head.load(std::memory_order_acquire)) {
+                out = slots[t & mask].load();
+                // 読んでいる間にproducerが捨てて上書きしたかもしれないので確認
+                if (tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel)) {
+                    return true;
+                }
+                continue;
+            }
+            if (policy != OverflowPolicy::Coalesce) {
+                return false;
+            }
+            std::uint64_t seq = latest_seq.load(std::memory_order_acquire);
+            if (seq == latest_ack.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            if (seq % 2 != 0) {
+                continue;
+            }
+            out = latest.load();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (latest_seq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+            // 溢れる前にリングへ入った分が残っていればそちらが先
+            // (未読の間はproducerはリングに入れないので、ここで見えていなければもう無い)
+            if (head.load(std::memory_order_acquire) != t) {
+                continue;
+            }
+            latest_ack.store(seq, std::memory_order_release);
+            return true;
+        }
+    }
+    bool empty() const
+    {
+        return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire)
+               && latest_seq.load(std::memory_order_acquire)
+                      == latest_ack.load(std::memory_order_acquire);
+    }
+
+    // 捨てた(Coalesceでは上書きした)個数
+    std::size_t dropped() const { return num_dropped.load(std::memory_order_relaxed); }
+};
+}  // namespace XViewMap
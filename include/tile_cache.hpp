@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace XViewMap
+{
+// ズーム段階と、その段階でのタイルの位置
+struct TileKey {
+    int level, tx, ty;
+    bool operator==(const TileKey& rhs) const
+    {
+        return level == rhs.level && tx == rhs.tx && ty == rhs.ty;
+    }
+};
+struct TileKeyHash {
+    std::size_t operator()(const TileKey& k) const
+    {
+        std::uint64_t h = static_cast<std::uint32_t>(k.tx);
+        h = h * 0x9E3779B97F4A7C15ull ^ static_cast<std::uint32_t>(k.ty);
+        h = h * 0x9E3779B97F4A7C15ull ^ static_cast<std::uint32_t>(k.level);
+        return static_cast<std::size_t>(h ^ (h >> 32));
+    }
+};
+
+// 最近使った順に並べたタイルのキャッシュ
+// findしたものが先頭に来て、evictすると後ろから捨てられる
+template <typename Tile>
+class TileCache
+{
+    using Entry = std::pair<TileKey, Tile>;
+    std::list<Entry> lru;
+    std::unordered_map<TileKey, typename std::list<Entry>::iterator, TileKeyHash> index;
+    std::size_t max_tiles;
+
+public:
+    explicit TileCache(std::size_t max_tiles) : max_tiles(max_tiles) {}
+    // 上限を変える(次のevictから)
+    void setMaxTiles(std::size_t n) { max_tiles = n; }
+
+    // 無ければnullptr
+    Tile* find(const TileKey& key)
+    {
+        auto it = index.find(key);
+        if (it == index.end()) {
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        return &it->second->second;
+    }
+    // 追加したものへの参照はevict/clearされるまで有効
+    Tile& insert(const TileKey& key, Tile tile)
+    {
+        lru.emplace_front(key, std::move(tile));
+        index[key] = lru.begin();
+        return lru.front().second;
+    }
+    // 上限を超えた分を古い順に捨てる
+    // ただし直近に使ったkeep個は残す
+    void evict(std::size_t keep, const std::function<void(Tile&)>& release)
+    {
+        while (lru.size() > max_tiles && lru.size() > keep) {
+            release(lru.back().second);
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+    }
+    void clear(const std::function<void(Tile&)>& release)
+    {
+        for (auto& e : lru) {
+            release(e.second);
+        }
+        lru.clear();
+        index.clear();
+    }
+    std::size_t size() const { return lru.size(); }
+};
+}  // namespace XViewMap
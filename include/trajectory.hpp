@@ -0,0 +1,257 @@
+#pragma once
+#include "pos.hpp"
+#include "spatial_grid.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace XViewMap
+{
+// 軌跡をどれだけ残すか(両方0なら全部残す)
+// 古い方からchunk単位で捨てるので、実際には少し多めに残る
+struct RetentionPolicy {
+    std::size_t max_points = 0;  // 最新の何点を残すか
+    double max_seconds = 0;      // 最新の何秒を残すか
+};
+
+// 軌跡の点を固定長のchunkに分けて持つ
+// 追加しても既存の点はコピーされず、捨てたchunkは再利用するので長時間動かしてもメモリが増え続けない
+// 点は追加された順の通し番号で参照する(捨てたりclearしたりしても番号は変わらない)
+// compactにすると、座標をchunkの最初の点からの差(0.5mm単位のint16)、角度を16bitで持つ
+// (1点24byte→6byte、差が入らなくなったら新しいchunkにする)
+class Trajectory
+{
+public:
+    static constexpr std::size_t chunk_size = 4096;
+    static constexpr double compact_unit = 0.5;  // compactのときの座標の単位(mm)
+    using Clock = std::chrono::steady_clock;
+
+private:
+    // 描画ではx,yだけをまとめて変換するので、要素ごとに別の配列にする
+    struct Chunk {
+        // compactでないとき
+        std::unique_ptr<double[]> x, y, th;
+        // compactのとき、座標は base + q * compact_unit
+        double base_x = 0, base_y = 0;
+        std::unique_ptr<std::int16_t[]> qx, qy;
+        std::unique_ptr<std::uint16_t[]> qth;
+
+        std::size_t first = 0;  // 最初の点の番号
+        std::size_t count = 0;
+        Clock::time_point last_time;  // 最後に追加した時刻
+        std::size_t last_source;      // 最後に追加した点の元の番号(間引いたものの場合)
+
+        double getX(std::size_t j) const { return x ? x[j] : base_x + qx[j] * compact_unit; }
+        double getY(std::size_t j) const { return y ? y[j] : base_y + qy[j] * compact_unit; }
+        double getTh(std::size_t j) const
+        {
+            return th ? th[j] : static_cast<std::int16_t>(qth[j]) * (M_PI / 32768);
+        }
+    };
+    bool compact;
+    std::vector<std::unique_ptr<Chunk>> chunks;  // 古い順
+    std::vector<std::unique_ptr<Chunk>> pool;    // 使っていないchunk
+    std::size_t first_index = 0;                 // chunks.front()の最初の点の番号
+    std::size_t end_index = 0;
+    // i番目の線分(i-1番目とi番目の点を結ぶ)の位置
+    SpatialGrid grid;
+
+    std::unique_ptr<Chunk> newChunk()
+    {
+        std::unique_ptr<Chunk> chunk;
+        if (pool.empty()) {
+            chunk = std::make_unique<Chunk>();
+            if (compact) {
+                chunk->qx.reset(new std::int16_t[chunk_size]);
+                chunk->qy.reset(new std::int16_t[chunk_size]);
+                chunk->qth.reset(new std::uint16_t[chunk_size]);
+            } else {
+                chunk->x.reset(new double[chunk_size]);
+                chunk->y.reset(new double[chunk_size]);
+                chunk->th.reset(new double[chunk_size]);
+            }
+        } else {
+            chunk = std::move(pool.back());
+            pool.pop_back();
+        }
+        chunk->first = end_index;
+        chunk->count = 0;
+        return chunk;
+    }
+    void releaseFront()
+    {
+        first_index += chunks.front()->count;
+        pool.push_back(std::move(chunks.front()));
+        chunks.erase(chunks.begin());
+        grid.prune(first_index);
+    }
+    // index番目の点が入っているchunk
+    const Chunk& chunkOf(std::size_t index) const
+    {
+        if (!compact) {
+            // 最後以外は全部埋まっている
+            return *chunks[(index - first_index) / chunk_size];
+        }
+        auto it = std::upper_bound(chunks.begin(), chunks.end(), index,
+            [](std::size_t i, const std::unique_ptr<Chunk>& c) { return i < c->first; });
+        return **(it - 1);
+    }
+    // compactのとき、chunkのbaseからの差がint16に入るか
+    static bool fits(const Chunk& chunk, const Pos& pos)
+    {
+        double qx = std::nearbyint((pos.x - chunk.base_x) / compact_unit);
+        double qy = std::nearbyint((pos.y - chunk.base_y) / compact_unit);
+        return qx >= -32768 && qx <= 32767 && qy >= -32768 && qy <= 32767;
+    }
+
+public:
+    explicit Trajectory(double cell_size = 500, bool compact = false)
+        : compact(compact), grid(cell_size)
+    {
+    }
+
+    // 残っている点の番号は[begin(), end())
+    std::size_t begin() const { return first_index; }
+    std::size_t end() const { return end_index; }
+    bool empty() const { return first_index == end_index; }
+    Pos operator[](std::size_t index) const
+    {
+        const Chunk& chunk = chunkOf(index);
+        std::size_t j = index - chunk.first;
+        return {chunk.getX(j), chunk.getY(j), chunk.getTh(j)};
+    }
+    Pos back() const { return (*this)[end_index - 1]; }
+    // [begin, end)の点を、連続している部分ごとにf(最初の番号, x, y, 個数)に渡す
+    // compactのときはblock_size個ずつ戻してから渡す
+    static constexpr std::size_t block_size = 256;
+    template <typename F>
+    void forEachSpan(std::size_t begin, std::size_t end, F&& f) const
+    {
+        std::array<double, block_size> bx, by;
+        while (begin < end) {
+            const Chunk& chunk = chunkOf(begin);
+            std::size_t j = begin - chunk.first;
+            std::size_t count = std::min(end - begin, chunk.count - j);
+            if (chunk.x) {
+                f(begin, chunk.x.get() + j, chunk.y.get() + j, count);
+            } else {
+                count = std::min(count, block_size);
+                for (std::size_t k = 0; k < count; k++) {
+                    bx[k] = chunk.base_x + chunk.qx[j + k] * compact_unit;
+                    by[k] = chunk.base_y + chunk.qy[j + k] * compact_unit;
+                }
+                f(begin, bx.data(), by.data(), count);
+            }
+            begin += count;
+        }
+    }
+    // 範囲にかかるかもしれない線分の番号を、[begin, end)に絞って返す
+    void querySegments(double min_x, double min_y, double max_x, double max_y, std::size_t begin,
+        std::size_t end, std::vector<SpatialGrid::Run>& runs) const
+    {
+        grid.query(min_x, min_y, max_x, max_y, begin, end, runs);
+    }
+
+    // sourceは間引く前の軌跡での番号
+    void push_back(const Pos& pos, Clock::time_point now, std::size_t source)
+    {
+        if (!empty()) {
+            Pos last = back();
+            grid.insert(std::min(last.x, pos.x), std::min(last.y, pos.y), std::max(last.x, pos.x),
+                std::max(last.y, pos.y), end_index);
+        }
+        if (chunks.empty() || chunks.back()->count == chunk_size
+            || (compact && !fits(*chunks.back(), pos))) {
+            chunks.push_back(newChunk());
+            chunks.back()->base_x = pos.x;
+            chunks.back()->base_y = pos.y;
+        }
+        Chunk& chunk = *chunks.back();
+        if (compact) {
+            chunk.qx[chunk.count] =
+                static_cast<std::int16_t>(std::nearbyint((pos.x - chunk.base_x) / compact_unit));
+            chunk.qy[chunk.count] =
+                static_cast<std::int16_t>(std::nearbyint((pos.y - chunk.base_y) / compact_unit));
+            double th = std::remainder(pos.th, 2 * M_PI);
+            chunk.qth[chunk.count] = static_cast<std::uint16_t>(
+                static_cast<std::int32_t>(std::nearbyint(th * (32768 / M_PI))) & 0xffff);
+        } else {
+            chunk.x[chunk.count] = pos.x;
+            chunk.y[chunk.count] = pos.y;
+            chunk.th[chunk.count] = pos.th;
+        }
+        chunk.count++;
+        chunk.last_time = now;
+        chunk.last_source = source;
+        end_index++;
+    }
+    void push_back(const Pos& pos, Clock::time_point now = Clock::now())
+    {
+        push_back(pos, now, end_index);
+    }
+    // 全部捨てる
+    void clear()
+    {
+        while (!chunks.empty()) {
+            releaseFront();
+        }
+        first_index = end_index;
+        grid.clear();
+    }
+    // 保持期間を過ぎたchunkを捨てる
+    // 1つでも捨てたらtrue
+    bool applyRetention(const RetentionPolicy& policy, Clock::time_point now = Clock::now())
+    {
+        bool released = false;
+        while (chunks.size() >= 2) {
+            std::size_t rest = end_index - first_index - chunks.front()->count;
+            bool over_points = policy.max_points > 0 && rest >= policy.max_points;
+            bool over_time = policy.max_seconds > 0
+                             && now - chunks.front()->last_time
+                                    > std::chrono::duration<double>(policy.max_seconds);
+            if (!over_points && !over_time) {
+                break;
+            }
+            releaseFront();
+            released = true;
+        }
+        return released;
+    }
+    // 元の番号がsource_beginより前の点しか無いchunkを捨てる
+    void releaseBefore(std::size_t source_begin)
+    {
+        while (chunks.size() >= 2 && chunks.front()->last_source < source_begin) {
+            releaseFront();
+        }
+    }
+};
+
+// 軌跡を間引いたもの
+// 直前に残した点からtolerance以上離れた点だけを残すので、元の軌跡からのずれはtolerance未満
+struct SimplifiedTrajectory {
+    double tolerance;
+    Trajectory points;
+
+    // 粗いものほど線分が長いので、セルも大きくする
+    SimplifiedTrajectory(double tolerance, bool compact)
+        : tolerance(tolerance), points(std::max(500.0, tolerance * 4), compact)
+    {
+    }
+    void push_back(const Pos& pos, Trajectory::Clock::time_point now, std::size_t source)
+    {
+        if (!points.empty()) {
+            Pos last = points.back();
+            double dx = pos.x - last.x, dy = pos.y - last.y;
+            if (dx * dx + dy * dy < tolerance * tolerance) {
+                return;
+            }
+        }
+        points.push_back(pos, now, source);
+    }
+};
+}  // namespace XViewMap
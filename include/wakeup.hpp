@@ -0,0 +1,37 @@
+#pragma once
+#include <atomic>
+
+namespace XViewMap
+{
+// poll()で待っているスレッドを他のスレッドから起こすためのfd
+// Linuxではeventfd、それ以外ではpipeを使う
+class Wakeup
+{
+    int read_fd = -1, write_fd = -1;
+    std::atomic<bool> waiting = false;
+
+public:
+    Wakeup();
+    ~Wakeup();
+    Wakeup(const Wakeup&) = delete;
+    Wakeup& operator=(const Wakeup&) = delete;
+
+    // pollに渡すfd
+    int fd() const { return read_fd; }
+
+    // 待つ側
+    // prepare()してから、待つ必要がまだあるか確認してpollする
+    // (prepare()より後に来たnotify()は必ずfdに届く)
+    void prepare();
+    // 起きたあと(pollしなかった場合も)に呼ぶ
+    void finish();
+    // fdが読めるようになっていたら呼んで、溜まった分を読み捨てる
+    void drain();
+
+    // 起こす側
+    // 相手が待っているときだけ書き込むので、起きている間はシステムコールを呼ばない
+    void notify();
+    // 待っているかどうかに関係なく起こす
+    void interrupt();
+};
+}  // namespace XViewMap
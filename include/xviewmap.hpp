@@ -1,17 +1,73 @@
 #pragma once
 #include "position.hpp"
+#include "seqlock.hpp"
+#include "spatial_grid.hpp"
+#include "mpsc_queue.hpp"
+#include "tile_cache.hpp"
+#include "wakeup.hpp"
 #include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <string>
 #include <thread>
 #include <vector>
 #include <utility>
+#include <variant>
 
 namespace XViewMap
 {
+class ThreadPool;
+template <typename Pixel>
+class BasicRasterImage;
+class RenderBackend;
+
+// 重ねて表示するもの
+enum class Layer {
+    Field,  // 壁など
+    Pos,    // updatePosの軌跡
+    Locus,  // updateLocusの軌跡
+    Robot,  // ロボットと速度
+};
+
+struct ViewMapOptions {
+    // updatePos/updateLocusから描画スレッドへ渡すキューの長さ
+    std::size_t queue_capacity = 4096;
+    // キューが溢れたとき(描画が追いつかないとき)の動作
+    OverflowPolicy overflow_policy = OverflowPolicy::DropOldest;
+    // 軌跡をどれだけ残すか(デフォルトは全部)
+    RetentionPolicy retention = {};
+    // 軌跡を0.5mm単位・角度16bitに丸めて持ち、メモリを1/4にする
+    bool compact_history = false;
+    // 画面を更新する頻度(Hz)
+    double frame_rate = 60;
+    // Xサーバーを使わずメモリ上に描く(環境変数XVIEWMAP_HEADLESS=1でも、Xに繋がらなかったときも)
+    bool headless = false;
+    int headless_width = 1280, headless_height = 720;
+    // 空でなければ、描画の操作をこのファイルに書き出す
+    std::string record_path;
+    // 描画済みのフィールドを保持しておくメモリ(Xサーバー側など)の上限(byte)
+    std::size_t tile_cache_size = 64 << 20;
+    // updatePosRT/updateLocusRTを使う
+    // 描画スレッドはそれらから起こされないので、何も無くてもframe_rateごとに見に行く
+    bool rt_ingest = false;
+    // 描画をforkした子プロセスで行う
+    // updatePosなどは共有メモリのリング(長さはqueue_capacity、溢れたら古いものから捨てる)に書くだけになり、
+    // 描画側(Xサーバーなど)が落ちたり止まったりしても呼び出した側には影響しない
+    // 子プロセスは呼び出したスレッドの優先度(SCHED_FIFOなど)やCPUの割り当てを引き継がず、普通に動く
+    // ViewMapを消すか、このプロセスが終わると子プロセスも終わる
+    // forkするので、他のスレッドを立てる前にViewMapを作ること
+    bool out_of_process = false;
+};
+
 class ViewMap
 {
 public:
-    ViewMap();
+    ViewMap() : ViewMap(ViewMapOptions{}) {}
+    explicit ViewMap(const ViewMapOptions& options);
     ~ViewMap();
 
     // ロボットの位置を更新
@@ -29,6 +85,18 @@ public:
     void resetLocus(const Pos& pos);
     void resetLocus(double x, double y, double th) { resetLocus({x, y, th}); }
 
+    // リアルタイムのスレッド(SCHED_FIFOなど)から呼ぶためのupdatePos/updateLocus
+    // ViewMapOptions::rt_ingestのとき、決まった回数のatomicな読み書きだけで、
+    // ロック・メモリ確保・システムコールを一切しない(rt_ingestでなければupdatePos/updateLocusと同じ)
+    // updatePos/updateLocusと同じスレッドから呼ぶこと(混ぜて使ってもよい)
+    void updatePosRT(const Pos& pos, const Pos& vel);
+    void updatePosRT(double x, double y, double th, double vx, double vy, double omg)
+    {
+        updatePosRT({x, y, th}, {vx, vy, omg});
+    }
+    void updateLocusRT(const Pos& pos);
+    void updateLocusRT(double x, double y, double th) { updateLocusRT({x, y, th}); }
+
     // フィールドサイズを設定
     void setField(double min_x, double min_y, double max_x, double max_y);
     // フィールドに線を引く(壁とか)
@@ -36,22 +104,24 @@ public:
     // フィールドに円or円弧を描く
     // x,yが原点、角度a1〜a2の範囲の円弧を描く(度、0はxの方向、a1=0 a2=360で円)
     void drawFieldArc(double x, double y, double r, double a1 = 0, double a2 = 360);
-    // 駆動輪の位置と角度(描画用、個数は任意)
-    std::vector<Pos> wheels = {
-        {200, 200, 135 * 3.14 / 180},
-        {-200, 200, -135 * 3.14 / 180},
-        {-200, -200, -45 * 3.14 / 180},
-        {200, -200, 45 * 3.14 / 180},
-    };
-    double wheel_radius = 50;
-    // マシンの形状(適当)
-    std::vector<Pos> machine = {
-        {150, 150},
-        {-150, 150},
-        {-150, -150},
-        {150, -150},
-        {200, 0},
-    };
+    // ロボットの形状(描画用)を変更
+    // wheelsは駆動輪の位置と角度(個数は任意)、machineは外形の頂点
+    void setRobot(
+        const std::vector<Pos>& wheels, double wheel_radius, const std::vector<Pos>& machine);
+    void setWheels(const std::vector<Pos>& wheels);
+    void setWheelRadius(double wheel_radius);
+    void setMachine(const std::vector<Pos>& machine);
+    const std::vector<Pos>& getWheels() const { return robot_shape.wheels; }
+    double getWheelRadius() const { return robot_shape.wheel_radius; }
+    const std::vector<Pos>& getMachine() const { return robot_shape.machine; }
+
+    // 画面を更新する頻度(Hz)を変更
+    void setFrameRate(double fps);
+    // レイヤーの表示・非表示を切り替える(描き直さずに重ね直すだけ)
+    void setLayerVisible(Layer layer, bool visible);
+
+    // headlessのとき、最後に描いた画面をPPM(P6)で保存する(out_of_processのときは使えない)
+    bool saveFrame(const std::string& path);
 
     // 指定したtomlファイルを読み込む
     void readToml(const std::string& path);
@@ -59,19 +129,25 @@ public:
     void readToml();
 
 private:
-    std::mutex x11_mutex;
-    std::optional<std::thread> win_thread, pos_thread, locus_thread;
-    void winThread();
-    void posThread(PositionHistory& history, unsigned long pixel);
-
-    // X11/Xlib.hをincludeするとdefine祭りで治安最悪になるので他の型で代用
-    std::optional<void* /* Display* */> v_display;
-    unsigned long /* Window */ win;
-    void* /* GC aka _XGC* */ v_gc;
-    unsigned long black_pixel, white_pixel, red_pixel, orange_pixel, forestgreen_pixel, blue_pixel;
-    std::optional<unsigned long /*Pixmap*/> field_p;
-    int screen_num;
-    void flush();
+    // out_of_processのとき、描画する子プロセスとの接続
+    // このViewMapは子プロセスに送るだけで、以下は使わない
+    struct Remote;
+    std::unique_ptr<Remote> remote;
+
+    // backend(Xの接続など)は描画スレッドだけが使う
+    // Xのイベント、溜まった軌跡、他のスレッドからの設定変更を処理して画面を更新する
+    // 何も無いときはbackendのfd(Xの接続)とwakeupをpollして寝ている
+    std::optional<std::thread> render_thread;
+    void renderThread();
+    Wakeup wakeup;
+    std::atomic<bool> terminated = false;
+    std::atomic<double> frame_rate;  // これより速くは画面を更新しない
+    // rt_ingestのとき、通知が来なくてもframe_rateごとに起きる
+    bool clock_driven;
+    bool dirty = true;               // 次のフレームで画面を更新する
+
+    // 実際に描く部分(X11かメモリ上)
+    std::unique_ptr<RenderBackend> backend;
 
     // 画面座標系: 左上原点、右がx、下がy
     int win_width, win_height;             // 画面の幅、高さ
@@ -80,46 +156,130 @@ private:
     double field_min_x, field_min_y, field_max_x, field_max_y;
     double field_width, field_height;
     double zoom;  // 画面座標=フィールド座標*zoom
+    // zoom = fit_zoom * zoom_rate^zoom_level
+    static constexpr double zoom_rate = 1.1;
+    double fit_zoom;
+    int zoom_level = 0;
 
     void resetFieldZoom();
     // フィールド座標→画面座標の変換
     int xFieldToWindow(double x);
     int yFieldToWindow(double y);
 
+    // フィールドを tile_size四方のタイルに分けてbackendのマスク(XならPixmap)に描いておき、
+    // 見える部分だけを画面に出す
+    // 軌跡などは描いたところまでを覚えておき、画面に出すときに続きを描き足す
+    // 壁など、posの軌跡、locusの軌跡はレイヤーごとに別のマスクに描き、画面に出すときに色を付けて重ねる
+    // (resetされた軌跡のレイヤーだけを描き直せる)
+    static constexpr int tile_size = 256;
+    static constexpr int field_layer = 0, pos_layer = 1, locus_layer = 2, tile_layers = 3;
+    struct Tile {
+        std::array<std::uintptr_t /* Surface */, tile_layers> masks = {};
+        int tx, ty;  // タイルの位置(tile_size単位、フィールドの左上が0)
+        std::array<bool, tile_layers> initialized = {};
+        std::array<bool, tile_layers> preview = {};  // 粗い軌跡で仮に描いたもの(軌跡のレイヤーだけ)
+        std::uint64_t pos_generation = 0, locus_generation = 0;
+        std::size_t lines_drawn = 0, arcs_drawn = 0, pos_drawn = 0, locus_drawn = 0;
+    };
+    TileCache<Tile> tiles;
+    // 画面のうち、タイルからコピーし直す部分(画面座標系、[x1, x2)×[y1, y2)、初期値は空)
+    // 前と今のロボットの範囲と、タイルに描き足した範囲だけを出し直す
+    // パン、ズーム、Expose、リサイズのときは画面全体(full_damage)
+    struct Rect {
+        int x1 = std::numeric_limits<int>::max(), y1 = std::numeric_limits<int>::max();
+        int x2 = std::numeric_limits<int>::min(), y2 = std::numeric_limits<int>::min();
+    };
+    std::vector<Rect> damaged;
+    bool full_damage = true;
+    Rect robot_rect;  // 最後に描いたロボットの範囲
+    void damage(const Rect& rect);
+    // タイルの中の座標で指定する
+    void damageTile(const Tile& tile, int x1, int y1, int x2, int y2);
+    // 全部のタイルを捨てる
     void resetPixmap();
+    void releaseTile(Tile& tile);
+    // レイヤーの描き直しが必要か(まだ描いていない、軌跡がresetされた)
+    bool layerOutdated(const Tile& tile, int layer) const;
+    // 足りない部分を描き足す
+    // previewなら粗く描く軌跡のレイヤー(tile.preview)だけ、そうでなければそれ以外のレイヤーを描く
+    // 軌跡は元からのずれがmax_error(フィールド座標)未満になる範囲で間引いて描く
+    void rasterizeTiles(const std::vector<Tile*>& tiles, double max_error, bool preview);
+    // タイルのレイヤーを描き直すとき、backendが受け取れるなら
+    // Xサーバーを通さずにメモリ上で並列に描いてから送る
+    std::unique_ptr<ThreadPool> raster_pool;
+    std::size_t raster_batch = 1;  // 一度に描くレイヤーの数
+    void rasterizeSoftware(const std::vector<Tile*>& tiles, double max_error);
+    void drawTileSoftware(
+        const Tile& tile, int layer, BasicRasterImage<std::uint8_t>& image,
+        const Trajectory* trajectory) const;
+    // 仮に描くときのずれ(ピクセル)
+    static constexpr double preview_pixels = 4;
+    // 1フレームのうちタイルを正確に描き直すのに使う割合
+    static constexpr double rasterize_budget = 0.5;
     void updateWindow();
 
     using LineData = std::pair<Pos, Pos>;
     struct ArcData {
         double x, y, r, a1, a2;
     };
+    struct FieldRange {
+        double min_x, min_y, max_x, max_y;
+    };
+    struct RobotShape {
+        std::vector<Pos> wheels;
+        double wheel_radius;
+        std::vector<Pos> machine;
+    };
+    struct LayerVisibility {
+        Layer layer;
+        bool visible;
+    };
+    // 他のスレッドから描画スレッドへの設定変更
+    using Command = std::variant<FieldRange, LineData, ArcData, RobotShape, LayerVisibility>;
+    MpscQueue<Command> commands;
+    void applyCommand(Command&& command);
+    // 呼び出し側の控え(変更したら描画スレッドに送る)
+    RobotShape robot_shape = {
+        {
+            {200, 200, 135 * 3.14 / 180},
+            {-200, 200, -135 * 3.14 / 180},
+            {-200, -200, -45 * 3.14 / 180},
+            {200, -200, 45 * 3.14 / 180},
+        },
+        50,
+        // 適当
+        {
+            {150, 150},
+            {-150, 150},
+            {-150, -150},
+            {150, -150},
+            {200, 0},
+        },
+    };
+    void sendRobotShape();
+    RobotShape robot;  // 描画スレッドが使う分
+    std::array<bool, 4> layer_visible = {true, true, true, true};
     std::vector<LineData> field_lines = {};
     std::vector<ArcData> field_arcs = {};
-    void drawFieldLine_impl(double x1, double y1, double x2, double y2, unsigned long pixel);
-    void drawFieldLine_impl(const Pos& p1, const Pos& p2, unsigned long pixel)
-    {
-        drawFieldLine_impl(p1.x, p1.y, p2.x, p2.y, pixel);
-    }
-    void drawFieldLine_impl(const LineData& ld, unsigned long pixel)
-    {
-        drawFieldLine_impl(ld.first, ld.second, pixel);
-    }
-    void drawWinLine_impl(double x1, double y1, double x2, double y2, unsigned long pixel);
-    void drawWinLine_impl(const Pos& p1, const Pos& p2, unsigned long pixel)
-    {
-        drawWinLine_impl(p1.x, p1.y, p2.x, p2.y, pixel);
-    }
-    void drawWinLine_impl(const LineData& ld, unsigned long pixel)
-    {
-        drawWinLine_impl(ld.first, ld.second, pixel);
-    }
-    void drawFieldArc_impl(double x, double y, double r, double a1, double a2, unsigned long pixel);
-    void drawFieldArc_impl(const ArcData& ad, unsigned long pixel)
-    {
-        drawFieldArc_impl(ad.x, ad.y, ad.r, ad.a1, ad.a2, pixel);
-    }
-    double vel_x, vel_y;
-    PositionHistory pos_history{}, locus_history{};
+    // field_lines(1から)とfield_arcsの位置
+    SpatialGrid field_line_grid, field_arc_grid;
+    // ロボットの最新の状態
+    // updatePos/resetPosのスレッドが書き、描画スレッドがロック無しで読む
+    struct RobotState {
+        Pos pos, vel;  // vel.thは角速度
+        bool valid = false;
+    };
+    SeqLock<RobotState> robot_state;
+    RobotState last_state;                  // 書く側の控え
+    std::uint64_t drawn_state_version = 0;  // 最後に画面に描いたrobot_stateのversion
+    // ロボットと速度を画面に描く
+    void drawRobot_impl(const RobotState& state);
+    // updatePos/updateLocusの本体、notifyなら描画スレッドを起こす
+    void storePos(const Pos& pos, const Pos& vel, bool notify);
+    void storeLocus(const Pos& pos, bool notify);
+    // drawRobot_implで描く範囲
+    Rect robotRect(const RobotState& state);
+    PositionHistory pos_history, locus_history;
 };
 
 }  // namespace XViewMap
@@ -0,0 +1,74 @@
+/* xviewmapに座標をバイナリで流すためのヘッダー(C/C++どちらからも使える)
+ *
+ * 1レコード64byte固定、リトルエンディアン
+ *   0  magic     "\0XV\1" (先頭が\0なので、テキストの行と混ぜて流してもよい)
+ *   4  uint16    kind (XVIEWMAP_RECORD_FIELDMAP / XVIEWMAP_RECORD_LOCUSMAP)
+ *   6  uint16    channel
+ *   8  uint64    timestamp (送る側の時刻、単位は自由)
+ *   16 double*6  x y th vx vy omega (LocusMapのときvx vy omegaは0)
+ *
+ * 使い方
+ *   unsigned char rec[XVIEWMAP_RECORD_SIZE];
+ *   xviewmap_record_fieldmap(rec, 0, t, x, y, th, vx, vy, omega);
+ *   fwrite(rec, 1, sizeof(rec), fp);
+ */
+#ifndef XVIEWMAP_RECORD_H
+#define XVIEWMAP_RECORD_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define XVIEWMAP_RECORD_SIZE 64
+#define XVIEWMAP_RECORD_MAGIC "\0XV\1"
+#define XVIEWMAP_RECORD_MAGIC_SIZE 4
+
+enum {
+    XVIEWMAP_RECORD_FIELDMAP = 1,
+    XVIEWMAP_RECORD_LOCUSMAP = 2,
+};
+
+static inline void xviewmap_put_u64(unsigned char* p, uint64_t v)
+{
+    int i;
+    for (i = 0; i < 8; i++) {
+        p[i] = (unsigned char)(v >> (i * 8));
+    }
+}
+static inline void xviewmap_put_f64(unsigned char* p, double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    xviewmap_put_u64(p, bits);
+}
+
+/* recにXVIEWMAP_RECORD_SIZE byte書き込む */
+static inline void xviewmap_record(unsigned char* rec, uint16_t kind, uint16_t channel,
+    uint64_t timestamp, double x, double y, double th, double vx, double vy, double omega)
+{
+    memcpy(rec, XVIEWMAP_RECORD_MAGIC, XVIEWMAP_RECORD_MAGIC_SIZE);
+    rec[4] = (unsigned char)kind;
+    rec[5] = (unsigned char)(kind >> 8);
+    rec[6] = (unsigned char)channel;
+    rec[7] = (unsigned char)(channel >> 8);
+    xviewmap_put_u64(rec + 8, timestamp);
+    xviewmap_put_f64(rec + 16, x);
+    xviewmap_put_f64(rec + 24, y);
+    xviewmap_put_f64(rec + 32, th);
+    xviewmap_put_f64(rec + 40, vx);
+    xviewmap_put_f64(rec + 48, vy);
+    xviewmap_put_f64(rec + 56, omega);
+}
+/* "0 [FieldMap] x y th vx vy omega" と同じ */
+static inline void xviewmap_record_fieldmap(unsigned char* rec, uint16_t channel,
+    uint64_t timestamp, double x, double y, double th, double vx, double vy, double omega)
+{
+    xviewmap_record(rec, XVIEWMAP_RECORD_FIELDMAP, channel, timestamp, x, y, th, vx, vy, omega);
+}
+/* "0 [LocusMap] x y th" と同じ */
+static inline void xviewmap_record_locusmap(
+    unsigned char* rec, uint16_t channel, uint64_t timestamp, double x, double y, double th)
+{
+    xviewmap_record(rec, XVIEWMAP_RECORD_LOCUSMAP, channel, timestamp, x, y, th, 0, 0, 0);
+}
+
+#endif
@@ -0,0 +1,115 @@
+/* xviewmap --shm NAME で作られる共有メモリのリングに座標を書き込むためのヘッダー(C/C++)
+ *
+ * 書き込み(xviewmap_shm_write)はシステムコール・ロック・待ちを一切しない
+ * リングが一周したら古いものから上書きするので、xviewmapが止まっていても書く側は止まらない
+ * 複数のプロセス・スレッドから同時に書いてよい
+ *
+ * 使い方
+ *   struct xviewmap_shm* shm = xviewmap_shm_open("/robot");  // xviewmapの起動前はNULL
+ *   // 毎周期実行
+ *   if (shm) xviewmap_shm_fieldmap(shm, 0, t, x, y, th, vx, vy, omega);
+ */
+#ifndef XVIEWMAP_SHM_H
+#define XVIEWMAP_SHM_H
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "xviewmap_record.h"
+
+#define XVIEWMAP_SHM_MAGIC 0x31676e6952505658ULL /* "XVPRing1" */
+
+/* 1レコード分(false sharingしないよう128byte) */
+struct xviewmap_shm_slot {
+    /* 2*i+1: i番目を書き込み中、2*i+2: i番目を書き終わった */
+    uint64_t seq;
+    uint64_t record[XVIEWMAP_RECORD_SIZE / 8];
+    uint64_t pad[7];
+};
+/* 共有メモリの先頭、この後ろにslotがcapacity個並ぶ */
+struct xviewmap_shm {
+    uint64_t magic; /* xviewmapが初期化し終わったら書く */
+    uint32_t capacity; /* slotの数(2の累乗) */
+    uint32_t pad0;
+    uint64_t pad1[6];
+    uint64_t write_index; /* 次に書く番号 */
+    uint64_t pad2[7];
+};
+
+static inline size_t xviewmap_shm_size(uint32_t capacity)
+{
+    return sizeof(struct xviewmap_shm) + (size_t)capacity * sizeof(struct xviewmap_shm_slot);
+}
+static inline struct xviewmap_shm_slot* xviewmap_shm_slots(struct xviewmap_shm* shm)
+{
+    return (struct xviewmap_shm_slot*)(shm + 1);
+}
+
+/* xviewmapが作ったリングを開く(nameは"/"から始まる名前)、無いか壊れていたらNULL */
+static inline struct xviewmap_shm* xviewmap_shm_open(const char* name)
+{
+    struct stat st;
+    void* p;
+    struct xviewmap_shm* shm;
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct xviewmap_shm)) {
+        close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    shm = (struct xviewmap_shm*)p;
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != XVIEWMAP_SHM_MAGIC
+        || shm->capacity == 0 || (shm->capacity & (shm->capacity - 1)) != 0
+        || xviewmap_shm_size(shm->capacity) > (size_t)st.st_size) {
+        munmap(p, (size_t)st.st_size);
+        return NULL;
+    }
+    return shm;
+}
+static inline void xviewmap_shm_close(struct xviewmap_shm* shm)
+{
+    munmap(shm, xviewmap_shm_size(shm->capacity));
+}
+
+/* recはxviewmap_record()で作ったXVIEWMAP_RECORD_SIZE byte */
+static inline void xviewmap_shm_write(struct xviewmap_shm* shm, const unsigned char* rec)
+{
+    uint64_t i = __atomic_fetch_add(&shm->write_index, 1, __ATOMIC_RELAXED);
+    struct xviewmap_shm_slot* slot = &xviewmap_shm_slots(shm)[i & (shm->capacity - 1)];
+    size_t k;
+    __atomic_store_n(&slot->seq, 2 * i + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (k = 0; k < XVIEWMAP_RECORD_SIZE / 8; k++) {
+        uint64_t w;
+        memcpy(&w, rec + k * 8, sizeof(w));
+        __atomic_store_n(&slot->record[k], w, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&slot->seq, 2 * i + 2, __ATOMIC_RELEASE);
+}
+static inline void xviewmap_shm_fieldmap(struct xviewmap_shm* shm, uint16_t channel,
+    uint64_t timestamp, double x, double y, double th, double vx, double vy, double omega)
+{
+    unsigned char rec[XVIEWMAP_RECORD_SIZE];
+    xviewmap_record_fieldmap(rec, channel, timestamp, x, y, th, vx, vy, omega);
+    xviewmap_shm_write(shm, rec);
+}
+static inline void xviewmap_shm_locusmap(struct xviewmap_shm* shm, uint16_t channel,
+    uint64_t timestamp, double x, double y, double th)
+{
+    unsigned char rec[XVIEWMAP_RECORD_SIZE];
+    xviewmap_record_locusmap(rec, channel, timestamp, x, y, th);
+    xviewmap_shm_write(shm, rec);
+}
+
+#endif
@@ -0,0 +1,121 @@
+#pragma once
+#include "transform.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace XViewMap
+{
+template <typename Pixel>
+class BasicRasterImage;
+using MaskImage = BasicRasterImage<std::uint8_t>;
+
+// XPointと同じ並び
+struct Point16 {
+    std::int16_t x, y;
+};
+// XArcと同じ並び
+// 外接する長方形の左上と幅、高さ、角度は1/64度(0が右、反時計回り)
+struct Arc16 {
+    std::int16_t x, y;
+    std::uint16_t width, height;
+    std::int16_t angle1, angle2;
+};
+
+// 描画先(画面かマスク)
+// マスクは描いたところが1、それ以外が0の1bitの画像で、blitで色を付けて画面に重ねる
+// 中身はbackendごとに違う(XならPixmapやWindowのid)
+using Surface = std::uintptr_t;
+
+// バックエンドが使う色の値
+struct Palette {
+    unsigned long black, white, red, orange, forestgreen, blue;
+};
+
+// 画面への操作
+struct InputEvent {
+    enum class Type {
+        Redraw,      // 画面が消えたので描き直す
+        Resize,      // x, yが新しい幅、高さ
+        Drag,        // x, yがマウスの位置
+        Release,     // マウスを離した
+        ScrollUp,    // x, yがマウスの位置
+        ScrollDown,  // x, yがマウスの位置
+    };
+    Type type;
+    int x = 0, y = 0;
+};
+
+// 描画の操作を受け取って実際に描く部分
+// シーン(タイル、軌跡、ロボット)の管理はViewMapがやり、ここは何を描くかを知らない
+// 描画スレッドからしか呼ばない(saveFrameは除く)
+// 線は幅2px
+class RenderBackend
+{
+protected:
+    Palette palette_ = {};
+    int width_ = 0, height_ = 0;
+
+public:
+    virtual ~RenderBackend() = default;
+
+    const Palette& palette() const { return palette_; }
+    // 最初の画面の大きさ(変わったときはResizeのイベントが来る)
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // pollで待つfd(無ければ-1)
+    virtual int fd() const { return -1; }
+    // 来ているイベントを1つ取り出す(無ければfalse)
+    virtual bool nextEvent(InputEvent& /* event */) { return false; }
+
+    virtual Surface screen() const = 0;
+    // 中身は不定
+    virtual Surface createMask(int width, int height) = 0;
+    virtual void destroyMask(Surface mask) = 0;
+    // マスク1枚が使うメモリ(byte、XならXサーバー側)
+    virtual std::size_t maskBytes(int width, int height) const = 0;
+
+    // 以下のpixelは、画面ならpaletteの色、マスクなら0か1
+    // drawSegmentsなどに一度に渡す量(byte)の上限
+    virtual std::size_t maxBatchBytes() const = 0;
+    virtual void fillRect(
+        Surface surface, int x, int y, int width, int height, unsigned long pixel) = 0;
+    virtual void drawSegments(
+        Surface surface, const Segment16* segments, std::size_t n, unsigned long pixel) = 0;
+    // n個の点を順に結ぶ
+    virtual void drawLines(
+        Surface surface, const Point16* points, std::size_t n, unsigned long pixel) = 0;
+    virtual void drawArcs(Surface surface, const Arc16* arcs, std::size_t n, unsigned long pixel) = 0;
+
+    // メモリ上で描いた画像(0以外を1とする)をマスクに送る
+    // 同時に描けるのはuploadSlots()枚まで(0なら使えない)
+    // uploadImage()で描き先を受け取り、描いたらupload()してから、まとめてfinishUpload()する
+    // 受け取った画像には別々のスレッドから描いてよい
+    virtual std::size_t uploadSlots() const = 0;
+    virtual MaskImage& uploadImage(std::size_t slot, Surface target) = 0;
+    virtual void upload(std::size_t /* slot */, Surface /* target */) {}
+    virtual void finishUpload() {}
+
+    // 1フレーム分: beginFrame()してからscreen()に描き、present()で出す
+    virtual void beginFrame() {}
+    // maskの(src_x, src_y)からwidth*heightの部分のうち1のところを、画面の(x, y)からpixelで塗る
+    virtual void blit(Surface mask, int src_x, int src_y, int width, int height, int x, int y,
+        unsigned long pixel) = 0;
+    virtual void present() = 0;
+
+    // 最後にpresentした画面をPPM(P6)で保存する(他のスレッドから呼んでよい)
+    virtual bool saveFrame(const std::string& path);
+};
+
+// 作れなかったらnullptr
+// upload_batchは一度にメモリ上で描くマスクの数(共有メモリを使うときの大きさ)
+std::unique_ptr<RenderBackend> createX11Backend(std::size_t upload_batch, int tile_size);
+// Xサーバーを使わずメモリ上に描く
+std::unique_ptr<RenderBackend> createSoftwareBackend(int width, int height);
+// backendに描きながら、呼ばれた操作をpathに書き出す
+// 同じ場面を別のbackendで描き比べるのに使う
+std::unique_ptr<RenderBackend> createRecordBackend(
+    std::unique_ptr<RenderBackend> backend, const std::string& path);
+}  // namespace XViewMap
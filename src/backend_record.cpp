@@ -0,0 +1,141 @@
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include "backend.hpp"
+
+namespace XViewMap
+{
+namespace
+{
+// 操作を1行ずつテキストで書き出しながら、backendに渡す
+//   mask <id> <width> <height>     (createMask)
+//   free <id>
+//   fill <id> <pixel> <x> <y> <width> <height>
+//   segments <id> <pixel> <n> x1 y1 x2 y2 ...
+//   lines <id> <pixel> <n> x y ...
+//   arcs <id> <pixel> <n> x y width height angle1 angle2 ...
+//   upload <id>
+//   begin
+//   blit <id> <src_x> <src_y> <width> <height> <x> <y> <pixel>
+//   present
+// idはbackendのSurfaceの値(画面はscreen()の値で、最初の行に書く)
+class RecordBackend : public RenderBackend
+{
+    std::unique_ptr<RenderBackend> backend;
+    std::ofstream ofs;
+
+public:
+    RecordBackend(std::unique_ptr<RenderBackend> backend_, const std::string& path)
+        : backend(std::move(backend_)), ofs(path)
+    {
+        palette_ = backend->palette();
+        width_ = backend->width();
+        height_ = backend->height();
+        if (!ofs) {
+            std::cerr << "[XViewMap] Failed to open " << path << std::endl;
+        }
+        ofs << "screen " << backend->screen() << " " << width_ << " " << height_ << "\n";
+    }
+    ~RecordBackend() override { ofs.flush(); }
+
+    int fd() const override { return backend->fd(); }
+    bool nextEvent(InputEvent& event) override { return backend->nextEvent(event); }
+
+    Surface screen() const override { return backend->screen(); }
+    Surface createMask(int width, int height) override
+    {
+        Surface mask = backend->createMask(width, height);
+        ofs << "mask " << mask << " " << width << " " << height << "\n";
+        return mask;
+    }
+    void destroyMask(Surface mask) override
+    {
+        ofs << "free " << mask << "\n";
+        backend->destroyMask(mask);
+    }
+    std::size_t maskBytes(int width, int height) const override
+    {
+        return backend->maskBytes(width, height);
+    }
+
+    std::size_t maxBatchBytes() const override { return backend->maxBatchBytes(); }
+    void fillRect(
+        Surface surface, int x, int y, int width, int height, unsigned long pixel) override
+    {
+        ofs << "fill " << surface << " " << pixel << " " << x << " " << y << " " << width << " "
+            << height << "\n";
+        backend->fillRect(surface, x, y, width, height, pixel);
+    }
+    void drawSegments(
+        Surface surface, const Segment16* segments, std::size_t n, unsigned long pixel) override
+    {
+        ofs << "segments " << surface << " " << pixel << " " << n;
+        for (std::size_t i = 0; i < n; i++) {
+            ofs << " " << segments[i].x1 << " " << segments[i].y1 << " " << segments[i].x2 << " "
+                << segments[i].y2;
+        }
+        ofs << "\n";
+        backend->drawSegments(surface, segments, n, pixel);
+    }
+    void drawLines(
+        Surface surface, const Point16* points, std::size_t n, unsigned long pixel) override
+    {
+        ofs << "lines " << surface << " " << pixel << " " << n;
+        for (std::size_t i = 0; i < n; i++) {
+            ofs << " " << points[i].x << " " << points[i].y;
+        }
+        ofs << "\n";
+        backend->drawLines(surface, points, n, pixel);
+    }
+    void drawArcs(Surface surface, const Arc16* arcs, std::size_t n, unsigned long pixel) override
+    {
+        ofs << "arcs " << surface << " " << pixel << " " << n;
+        for (std::size_t i = 0; i < n; i++) {
+            ofs << " " << arcs[i].x << " " << arcs[i].y << " " << arcs[i].width << " "
+                << arcs[i].height << " " << arcs[i].angle1 << " " << arcs[i].angle2;
+        }
+        ofs << "\n";
+        backend->drawArcs(surface, arcs, n, pixel);
+    }
+
+    // メモリ上で描いたものは中身を書き出さない
+    std::size_t uploadSlots() const override { return backend->uploadSlots(); }
+    MaskImage& uploadImage(std::size_t slot, Surface target) override
+    {
+        return backend->uploadImage(slot, target);
+    }
+    void upload(std::size_t slot, Surface target) override
+    {
+        ofs << "upload " << target << "\n";
+        backend->upload(slot, target);
+    }
+    void finishUpload() override { backend->finishUpload(); }
+
+    void beginFrame() override
+    {
+        ofs << "begin\n";
+        backend->beginFrame();
+    }
+    void blit(Surface mask, int src_x, int src_y, int width, int height, int x, int y,
+        unsigned long pixel) override
+    {
+        ofs << "blit " << mask << " " << src_x << " " << src_y << " " << width << " " << height
+            << " " << x << " " << y << " " << pixel << "\n";
+        backend->blit(mask, src_x, src_y, width, height, x, y, pixel);
+    }
+    void present() override
+    {
+        ofs << "present\n";
+        backend->present();
+    }
+
+    bool saveFrame(const std::string& path) override { return backend->saveFrame(path); }
+};
+}  // namespace
+
+std::unique_ptr<RenderBackend> createRecordBackend(
+    std::unique_ptr<RenderBackend> backend, const std::string& path)
+{
+    return std::make_unique<RecordBackend>(std::move(backend), path);
+}
+}  // namespace XViewMap
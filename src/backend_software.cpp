@@ -0,0 +1,149 @@
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "backend.hpp"
+#include "raster.hpp"
+
+namespace XViewMap
+{
+bool RenderBackend::saveFrame(const std::string&)
+{
+    std::cerr << "[XViewMap] saveFrame is only available when rendering offscreen" << std::endl;
+    return false;
+}
+
+namespace
+{
+// Xサーバー無しで、メモリ上のframeに描く
+// Surfaceは画面ならRasterImage*、マスクならMaskImage*(1画素1byte)
+class SoftwareBackend : public RenderBackend
+{
+    std::unique_ptr<RasterImage> frame;
+    std::mutex frame_mtx;  // saveFrame()が途中の画面を読まないように
+    std::unique_lock<std::mutex> frame_lock;
+
+    static MaskImage& maskImage(Surface surface)
+    {
+        return *reinterpret_cast<MaskImage*>(surface);
+    }
+    // 画面かマスクかで分ける
+    template <typename F>
+    void withImage(Surface surface, unsigned long pixel, F&& f)
+    {
+        if (surface == screen()) {
+            f(*frame, static_cast<std::uint32_t>(pixel));
+        } else {
+            f(maskImage(surface), static_cast<std::uint8_t>(pixel));
+        }
+    }
+
+public:
+    SoftwareBackend(int width, int height)
+    {
+        width_ = width;
+        height_ = height;
+        palette_ = {0xff000000, 0xffffffff, 0xffff0000, 0xffffa500, 0xff228b22, 0xff0000ff};
+        frame = std::make_unique<RasterImage>(width, height);
+        frame->fill(static_cast<std::uint32_t>(palette_.white));
+    }
+
+    Surface screen() const override { return reinterpret_cast<Surface>(frame.get()); }
+    Surface createMask(int width, int height) override
+    {
+        return reinterpret_cast<Surface>(new MaskImage(width, height));
+    }
+    void destroyMask(Surface mask) override { delete &maskImage(mask); }
+    std::size_t maskBytes(int width, int height) const override
+    {
+        return static_cast<std::size_t>(width) * height;
+    }
+
+    std::size_t maxBatchBytes() const override { return 64 * 1024; }
+    void fillRect(
+        Surface surface, int x, int y, int width, int height, unsigned long pixel) override
+    {
+        withImage(surface, pixel,
+            [&](auto& image, auto color) { image.fillRect(x, y, width, height, color); });
+    }
+    void drawSegments(
+        Surface surface, const Segment16* segments, std::size_t n, unsigned long pixel) override
+    {
+        withImage(surface, pixel, [&](auto& image, auto color) {
+            for (std::size_t i = 0; i < n; i++) {
+                const Segment16& s = segments[i];
+                image.drawLine(s.x1, s.y1, s.x2, s.y2, color);
+            }
+        });
+    }
+    void drawLines(
+        Surface surface, const Point16* points, std::size_t n, unsigned long pixel) override
+    {
+        withImage(surface, pixel, [&](auto& image, auto color) {
+            for (std::size_t i = 1; i < n; i++) {
+                image.drawLine(points[i - 1].x, points[i - 1].y, points[i].x, points[i].y, color);
+            }
+        });
+    }
+    void drawArcs(Surface surface, const Arc16* arcs, std::size_t n, unsigned long pixel) override
+    {
+        withImage(surface, pixel, [&](auto& image, auto color) {
+            for (std::size_t i = 0; i < n; i++) {
+                const Arc16& a = arcs[i];
+                double a1 = a.angle1 / 64.0;
+                image.drawArc(a.x + a.width / 2.0, a.y + a.height / 2.0, a.width / 2.0, a1,
+                    a1 + a.angle2 / 64.0, color);
+            }
+        });
+    }
+
+    // マスクに直接描く
+    std::size_t uploadSlots() const override { return static_cast<std::size_t>(-1); }
+    MaskImage& uploadImage(std::size_t, Surface target) override { return maskImage(target); }
+
+    void beginFrame() override { frame_lock = std::unique_lock(frame_mtx); }
+    void blit(Surface mask, int src_x, int src_y, int width, int height, int x, int y,
+        unsigned long pixel) override
+    {
+        frame->fillMasked(maskImage(mask), src_x, src_y, width, height, x, y,
+            static_cast<std::uint32_t>(pixel));
+    }
+    void present() override
+    {
+        if (frame_lock) {
+            frame_lock.unlock();
+        }
+    }
+
+    bool saveFrame(const std::string& path) override
+    {
+        std::ofstream ofs(path, std::ios::binary);
+        if (!ofs) {
+            std::cerr << "[XViewMap] Failed to open " << path << std::endl;
+            return false;
+        }
+        std::lock_guard lock(frame_mtx);
+        ofs << "P6\n" << frame->getWidth() << " " << frame->getHeight() << "\n255\n";
+        std::vector<char> row(static_cast<std::size_t>(frame->getWidth()) * 3);
+        for (int y = 0; y < frame->getHeight(); y++) {
+            const std::uint32_t* pixels =
+                frame->data() + static_cast<std::size_t>(y) * frame->getWidth();
+            for (int x = 0; x < frame->getWidth(); x++) {
+                row[x * 3] = static_cast<char>(pixels[x] >> 16);
+                row[x * 3 + 1] = static_cast<char>(pixels[x] >> 8);
+                row[x * 3 + 2] = static_cast<char>(pixels[x]);
+            }
+            ofs.write(row.data(), static_cast<std::streamsize>(row.size()));
+        }
+        return static_cast<bool>(ofs);
+    }
+};
+}  // namespace
+
+std::unique_ptr<RenderBackend> createSoftwareBackend(int width, int height)
+{
+    return std::make_unique<SoftwareBackend>(width, height);
+}
+}  // namespace XViewMap
@@ -0,0 +1,380 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#ifdef XVIEWMAP_USE_XSHM
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "backend.hpp"
+#include "raster.hpp"
+
+namespace XViewMap
+{
+namespace
+{
+static_assert(sizeof(Segment16) == sizeof(XSegment), "Segment16 must match XSegment");
+static_assert(sizeof(Point16) == sizeof(XPoint), "Point16 must match XPoint");
+static_assert(sizeof(Arc16) == sizeof(XArc), "Arc16 must match XArc");
+
+// srcの0以外を1として、1bitのdstのy_offset行目から詰める
+void packBits(const MaskImage& src, XImage* dst, int y_offset)
+{
+    // 1byte単位で詰めてよい並びか(unitの中のbyteの順番とbitの順番が同じ)
+    bool bytewise = dst->bitmap_unit == 8 || dst->byte_order == dst->bitmap_bit_order;
+    bool lsb = dst->bitmap_bit_order == LSBFirst;
+    for (int y = 0; y < src.getHeight(); y++) {
+        const std::uint8_t* pixels = src.data() + static_cast<std::size_t>(y) * src.getWidth();
+        if (!bytewise) {
+            for (int x = 0; x < src.getWidth(); x++) {
+                XPutPixel(dst, x, y_offset + y, pixels[x] != 0);
+            }
+            continue;
+        }
+        auto row = reinterpret_cast<unsigned char*>(
+            dst->data + static_cast<std::size_t>(y_offset + y) * dst->bytes_per_line);
+        for (int x = 0; x < src.getWidth(); x += 8) {
+            unsigned char bits = 0;
+            for (int k = 0; k < 8 && x + k < src.getWidth(); k++) {
+                if (pixels[x + k]) {
+                    bits |= lsb ? 1 << k : 0x80 >> k;
+                }
+            }
+            row[x / 8] = bits;
+        }
+    }
+}
+
+#ifdef XVIEWMAP_USE_XSHM
+// XShmAttachの失敗はエラーイベントで返ってくる
+bool shm_attach_failed = false;
+int shmAttachErrorHandler(Display*, XErrorEvent*)
+{
+    shm_attach_failed = true;
+    return 0;
+}
+
+// upload_batch枚のマスクを縦に並べた共有メモリのXImage(1bit)
+struct ShmImage {
+    Display* display;
+    XShmSegmentInfo info = {};
+    XImage* image = nullptr;
+    bool attached = false;
+
+    ~ShmImage()
+    {
+        if (attached) {
+            XShmDetach(display, &info);
+            XSync(display, False);
+        }
+        if (image) {
+            XDestroyImage(image);
+        }
+        if (info.shmaddr) {
+            shmdt(info.shmaddr);
+        }
+    }
+};
+#else
+struct ShmImage {
+};
+#endif
+
+class X11Backend : public RenderBackend
+{
+    Display* display;
+    Window win;
+    GC gc;
+    GC mask_gc;       // マスク(depth 1のPixmap)に描く
+    GC composite_gc;  // マスクをclip maskにして画面を塗る
+    int screen_num;
+    Visual* visual;
+    int screen_depth;
+    int tile_size;
+
+    GC gcFor(Surface surface) const { return surface == win ? gc : mask_gc; }
+
+    // メモリ上で描いた画像は1bitに詰めてから送る
+    std::size_t upload_batch;
+    std::vector<std::unique_ptr<MaskImage>> raster_images;
+    std::vector<char> bitmap_data;
+    XImage bitmap = {};
+    // ローカルの接続でMIT-SHMが使えるなら、共有メモリに詰めてXShmPutImageで送る
+    std::unique_ptr<ShmImage> shm_image;
+    void createShmImage();
+
+public:
+    X11Backend(Display* display, std::size_t upload_batch, int tile_size);
+    ~X11Backend() override;
+
+    int fd() const override { return ConnectionNumber(display); }
+    bool nextEvent(InputEvent& event) override;
+
+    Surface screen() const override { return win; }
+    Surface createMask(int width, int height) override
+    {
+        return XCreatePixmap(display, win, width, height, 1);
+    }
+    void destroyMask(Surface mask) override { XFreePixmap(display, mask); }
+    std::size_t maskBytes(int width, int height) const override
+    {
+        // depth 1のPixmap
+        return static_cast<std::size_t>((width + 7) / 8) * height;
+    }
+
+    std::size_t maxBatchBytes() const override
+    {
+        // リクエストのヘッダ(3単位)を除いた残りに入るだけ(単位は4byte)
+        return (static_cast<std::size_t>(XMaxRequestSize(display)) - 3) * 4;
+    }
+    void fillRect(
+        Surface surface, int x, int y, int width, int height, unsigned long pixel) override
+    {
+        XSetForeground(display, gcFor(surface), pixel);
+        XFillRectangle(display, surface, gcFor(surface), x, y, width, height);
+    }
+    void drawSegments(
+        Surface surface, const Segment16* segments, std::size_t n, unsigned long pixel) override
+    {
+        XSetForeground(display, gcFor(surface), pixel);
+        XDrawSegments(display, surface, gcFor(surface),
+            reinterpret_cast<XSegment*>(const_cast<Segment16*>(segments)), static_cast<int>(n));
+    }
+    void drawLines(
+        Surface surface, const Point16* points, std::size_t n, unsigned long pixel) override
+    {
+        XSetForeground(display, gcFor(surface), pixel);
+        XDrawLines(display, surface, gcFor(surface),
+            reinterpret_cast<XPoint*>(const_cast<Point16*>(points)), static_cast<int>(n),
+            CoordModeOrigin);
+    }
+    void drawArcs(Surface surface, const Arc16* arcs, std::size_t n, unsigned long pixel) override
+    {
+        XSetForeground(display, gcFor(surface), pixel);
+        XDrawArcs(display, surface, gcFor(surface),
+            reinterpret_cast<XArc*>(const_cast<Arc16*>(arcs)), static_cast<int>(n));
+    }
+
+    std::size_t uploadSlots() const override
+    {
+        // 共有メモリはupload_batch枚分しか無い
+        return shm_image ? upload_batch : static_cast<std::size_t>(-1);
+    }
+    MaskImage& uploadImage(std::size_t slot, Surface) override
+    {
+        while (raster_images.size() <= slot) {
+            raster_images.push_back(std::make_unique<MaskImage>(tile_size, tile_size));
+        }
+        return *raster_images[slot];
+    }
+    void upload(std::size_t slot, Surface target) override
+    {
+        // XYBitmapの1はforeground、0はbackgroundになる
+        XSetForeground(display, mask_gc, 1);
+        XSetBackground(display, mask_gc, 0);
+#ifdef XVIEWMAP_USE_XSHM
+        if (shm_image) {
+            packBits(*raster_images[slot], shm_image->image, static_cast<int>(slot) * tile_size);
+            XShmPutImage(display, target, mask_gc, shm_image->image, 0,
+                static_cast<int>(slot) * tile_size, 0, 0, tile_size, tile_size, False);
+            return;
+        }
+#endif
+        packBits(*raster_images[slot], &bitmap, 0);
+        XPutImage(display, target, mask_gc, &bitmap, 0, 0, 0, 0, tile_size, tile_size);
+    }
+    void finishUpload() override
+    {
+        if (shm_image) {
+            // サーバーが読み終わるまで共有メモリに次を描けない
+            XSync(display, False);
+        }
+    }
+
+    void blit(Surface mask, int src_x, int src_y, int width, int height, int x, int y,
+        unsigned long pixel) override
+    {
+        XSetClipMask(display, composite_gc, mask);
+        XSetClipOrigin(display, composite_gc, x - src_x, y - src_y);
+        XSetForeground(display, composite_gc, pixel);
+        XFillRectangle(display, win, composite_gc, x, y, width, height);
+    }
+    void present() override { XFlush(display); }
+};
+
+X11Backend::X11Backend(Display* display, std::size_t upload_batch, int tile_size)
+    : display(display), tile_size(tile_size), upload_batch(upload_batch)
+{
+    // ほぼ https://github.com/QMonkey/Xlib-demo/blob/master/src/simple-drawing.c
+    // のコピペ
+
+    screen_num = DefaultScreen(display);
+    // フルスクリーンのサイズ?
+    int dwidth = DisplayWidth(display, screen_num);
+    int dheight = DisplayHeight(display, screen_num);
+    // 画面位置とサイズ
+    int winx = 0, winy = 0;
+    width_ = dwidth * 2 / 3;
+    height_ = dheight * 2 / 3;
+    int win_border_width = 2;
+    palette_.black = BlackPixel(display, screen_num);
+    palette_.white = WhitePixel(display, screen_num);
+    win = XCreateSimpleWindow(display, RootWindow(display, screen_num), winx, winy, width_,
+        height_, win_border_width, palette_.black, palette_.white);
+
+    // 画面を表示
+    XMapWindow(display, win);
+    XStoreName(display, win, "XViewMap");
+    XFlush(display);
+
+    // マウス入力を有効にする
+    XSelectInput(display, win,
+        ButtonMotionMask | ButtonPressMask | ButtonReleaseMask | StructureNotifyMask
+            | ExposureMask);
+
+    XGCValues values;
+    gc = XCreateGC(display, win, 0, &values);
+    // if (gc < 0) {
+    //     std::cerr << "[XViewMap] Failed to create gc" << std::endl;
+    //     return;
+    // }
+    XSetBackground(display, gc, palette_.white);
+
+    int line_style = LineSolid;
+    int cap_style = CapButt;
+    int join_style = JoinBevel;
+    int line_width = 2;
+    XSetLineAttributes(display, gc, line_width, line_style, cap_style, join_style);
+    XSetFillStyle(display, gc, FillSolid);
+    // GCはdepthが同じDrawableにしか使えないので、マスク用は仮のPixmapで作る
+    Pixmap tmp = XCreatePixmap(display, win, 1, 1, 1);
+    mask_gc = XCreateGC(display, tmp, 0, &values);
+    XSetLineAttributes(display, mask_gc, line_width, line_style, cap_style, join_style);
+    XFreePixmap(display, tmp);
+    composite_gc = XCreateGC(display, win, 0, &values);
+
+    Colormap screen_colormap = DefaultColormap(display, DefaultScreen(display));
+    XColor c;
+#define XColorDef(col)                                        \
+    XAllocNamedColor(display, screen_colormap, #col, &c, &c); \
+    palette_.col = c.pixel;
+    XColorDef(red);
+    XColorDef(orange);
+    XColorDef(forestgreen);
+    XColorDef(blue);
+#undef XColorDef
+
+    visual = DefaultVisual(display, screen_num);
+    screen_depth = DefaultDepth(display, screen_num);
+
+    bitmap_data.resize(static_cast<std::size_t>(tile_size) * tile_size / 8);
+    bitmap.width = bitmap.height = tile_size;
+    bitmap.format = XYBitmap;
+    bitmap.data = bitmap_data.data();
+    bitmap.byte_order = LSBFirst;
+    bitmap.bitmap_unit = 8;
+    bitmap.bitmap_bit_order = LSBFirst;
+    bitmap.bitmap_pad = 8;
+    bitmap.depth = 1;
+    bitmap.bytes_per_line = tile_size / 8;
+    bitmap.bits_per_pixel = 1;
+    XInitImage(&bitmap);
+    createShmImage();
+}
+X11Backend::~X11Backend()
+{
+    shm_image.reset();
+    XFreeGC(display, mask_gc);
+    XFreeGC(display, composite_gc);
+    XFreeGC(display, gc);
+    XCloseDisplay(display);
+}
+
+bool X11Backend::nextEvent(InputEvent& event)
+{
+    while (XPending(display)) {
+        XEvent ev;
+        XNextEvent(display, &ev);
+        switch (ev.type) {
+        case Expose:
+            event = {InputEvent::Type::Redraw};
+            return true;
+        case ConfigureNotify:  // 画面サイズが変わったとき
+            event = {InputEvent::Type::Resize, ev.xconfigure.width, ev.xconfigure.height};
+            return true;
+        case MotionNotify:  // マウスドラッグ
+            event = {InputEvent::Type::Drag, ev.xmotion.x, ev.xmotion.y};
+            return true;
+        case ButtonRelease:
+            event = {InputEvent::Type::Release};
+            return true;
+        case ButtonPress:  // スクロール
+            if (ev.xbutton.button == 4) {
+                event = {InputEvent::Type::ScrollUp, ev.xbutton.x, ev.xbutton.y};
+                return true;
+            }
+            if (ev.xbutton.button == 5) {
+                event = {InputEvent::Type::ScrollDown, ev.xbutton.x, ev.xbutton.y};
+                return true;
+            }
+            break;
+        }
+    }
+    return false;
+}
+
+void X11Backend::createShmImage()
+{
+#ifdef XVIEWMAP_USE_XSHM
+    // 共有メモリはローカルの接続でしか使えない
+    std::string_view name = DisplayString(display);
+    if (!(name.substr(0, 1) == ":" || name.substr(0, 5) == "unix:") || !XShmQueryExtension(display)) {
+        return;
+    }
+    auto shm = std::make_unique<ShmImage>();
+    shm->display = display;
+    shm->image = XShmCreateImage(display, visual, 1, XYBitmap, nullptr, &shm->info, tile_size,
+        tile_size * upload_batch);
+    if (!shm->image) {
+        return;
+    }
+    shm->info.shmid = shmget(IPC_PRIVATE,
+        static_cast<std::size_t>(shm->image->bytes_per_line) * shm->image->height,
+        IPC_CREAT | 0600);
+    if (shm->info.shmid < 0) {
+        return;
+    }
+    void* addr = shmat(shm->info.shmid, nullptr, 0);
+    if (addr != reinterpret_cast<void*>(-1)) {
+        shm->info.shmaddr = shm->image->data = static_cast<char*>(addr);
+        shm->info.readOnly = False;
+        shm_attach_failed = false;
+        auto old_handler = XSetErrorHandler(shmAttachErrorHandler);
+        shm->attached = XShmAttach(display, &shm->info);
+        XSync(display, False);
+        XSetErrorHandler(old_handler);
+        shm->attached = shm->attached && !shm_attach_failed;
+    }
+    // 両方がdetachしたら消えるようにしておく
+    shmctl(shm->info.shmid, IPC_RMID, nullptr);
+    if (!shm->attached) {
+        return;
+    }
+    shm_image = std::move(shm);
+#endif
+}
+}  // namespace
+
+std::unique_ptr<RenderBackend> createX11Backend(std::size_t upload_batch, int tile_size)
+{
+    Display* display = XOpenDisplay(nullptr);
+    if (display == nullptr) {
+        return nullptr;
+    }
+    return std::make_unique<X11Backend>(display, upload_batch, tile_size);
+}
+}  // namespace XViewMap
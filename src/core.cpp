@@ -1,240 +1,445 @@
-#include <X11/Xlib.h>
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <poll.h>
+#include <memory>
+#include <string_view>
+#include <vector>
 #include <xviewmap.hpp>
+#include "backend.hpp"
+#include "raster.hpp"
+#include "remote.hpp"
+#include "thread_pool.hpp"
+#include "transform.hpp"
 
 namespace XViewMap
 {
+namespace
+{
+// 同じ色の線分・折れ線・円弧を貯めておき、backendが一度に受け取れる量ごとにまとめて渡す
+// Point16は1本の折れ線として扱い、分割するときは前の最後の点から続ける
+template <typename T>
+class DrawBatch
+{
+    RenderBackend& backend;
+    Surface surface;
+    unsigned long pixel;
+    std::vector<T> items;
+    std::size_t max_items;
+
+public:
+    DrawBatch(RenderBackend& backend, Surface surface, unsigned long pixel)
+        : backend(backend), surface(surface), pixel(pixel),
+          max_items(backend.maxBatchBytes() / sizeof(T))
+    {
+    }
+    DrawBatch(const DrawBatch&) = delete;
+    DrawBatch& operator=(const DrawBatch&) = delete;
+    ~DrawBatch() { flush(); }
+
+    void add(const T& item)
+    {
+        items.push_back(item);
+        if (items.size() >= max_items) {
+            flush();
+        }
+    }
+    void flush();
+};
+template <>
+void DrawBatch<Segment16>::flush()
+{
+    if (!items.empty()) {
+        backend.drawSegments(surface, items.data(), items.size(), pixel);
+        items.clear();
+    }
+}
+template <>
+void DrawBatch<Point16>::flush()
+{
+    if (items.size() >= 2) {
+        backend.drawLines(surface, items.data(), items.size(), pixel);
+        Point16 last = items.back();
+        items.clear();
+        items.push_back(last);
+    }
+}
+template <>
+void DrawBatch<Arc16>::flush()
+{
+    if (!items.empty()) {
+        backend.drawArcs(surface, items.data(), items.size(), pixel);
+        items.clear();
+    }
+}
+
+// 負の方向にも切り捨てる割り算
+int floorDiv(int a, int b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+}  // namespace
+
 // コンストラクタ、スレッド
-ViewMap::ViewMap()
+ViewMap::ViewMap(const ViewMapOptions& options)
+    : frame_rate(options.frame_rate), clock_driven(options.rt_ingest),
+      tiles(1),
+      pos_history(options.queue_capacity, options.overflow_policy, options.retention,
+          options.compact_history),
+      locus_history(options.queue_capacity, options.overflow_policy, options.retention,
+          options.compact_history)
 {
-    // ほぼ https://github.com/QMonkey/Xlib-demo/blob/master/src/simple-drawing.c
-    // のコピペ
+    if (options.out_of_process) {
+        remote = Remote::start(options);
+        if (remote) {
+            return;
+        }
+        std::cerr << "[XViewMap] Failed to start viewer process, rendering in this process"
+                  << std::endl;
+    }
 
-    Display* display = XOpenDisplay(nullptr);
-    if (display == nullptr) {
-        std::cerr << "[XViewMap] Failed to create display" << std::endl;
-        return;
+    // タイルをメモリ上で並列に描くときのスレッド数
+    unsigned int threads = std::max(std::thread::hardware_concurrency(), 1u);
+    raster_batch = threads * 2;
+
+    // 環境変数XVIEWMAP_HEADLESSでも選べる
+    const char* headless_env = std::getenv("XVIEWMAP_HEADLESS");
+    bool headless = options.headless
+                    || (headless_env && *headless_env && std::string_view(headless_env) != "0");
+    if (!headless) {
+        backend = createX11Backend(raster_batch, tile_size);
+        if (!backend) {
+            std::cerr << "[XViewMap] Failed to create display, rendering offscreen" << std::endl;
+        }
+    }
+    if (!backend) {
+        backend = createSoftwareBackend(options.headless_width, options.headless_height);
+    }
+    if (!options.record_path.empty()) {
+        backend = createRecordBackend(std::move(backend), options.record_path);
+    }
+    win_width = backend->width();
+    win_height = backend->height();
+    // タイル1枚はレイヤーの数だけマスクを持つ
+    tiles.setMaxTiles(std::max<std::size_t>(
+        options.tile_cache_size / (tile_layers * backend->maskBytes(tile_size, tile_size)), 1));
+    if (backend->uploadSlots() > 0) {
+        raster_pool = std::make_unique<ThreadPool>(threads - 1);
     }
-    v_display = static_cast<void*>(display);
-
-    screen_num = DefaultScreen(display);
-    // フルスクリーンのサイズ?
-    int dwidth = DisplayWidth(display, screen_num);
-    int dheight = DisplayHeight(display, screen_num);
-    // 画面位置とサイズ
-    int winx = 0, winy = 0;
-    win_width = dwidth * 2 / 3;
-    win_height = dheight * 2 / 3;
-    int win_border_width = 2;
-    black_pixel = BlackPixel(display, screen_num);
-    white_pixel = WhitePixel(display, screen_num);
-    win = XCreateSimpleWindow(display, RootWindow(display, screen_num), winx, winy, win_width,
-        win_height, win_border_width, black_pixel, white_pixel);
-
-    // 画面を表示
-    XMapWindow(display, win);
-    XStoreName(display, win, "XViewMap");
-    flush();
-
-    // マウス入力を有効にする
-    XSelectInput(display, win,
-        ButtonMotionMask | ButtonPressMask | ButtonReleaseMask | StructureNotifyMask
-            | ExposureMask);
-
-    XGCValues values;
-    GC gc = XCreateGC(display, win, 0, &values);
-    v_gc = gc;
-    // if (gc < 0) {
-    //     std::cerr << "[XViewMap] Failed to create gc" << std::endl;
-    //     return;
-    // }
-    XSetBackground(display, gc, white_pixel);
-
-    int line_style = LineSolid;
-    int cap_style = CapButt;
-    int join_style = JoinBevel;
-    int line_width = 2;
-    XSetLineAttributes(display, gc, line_width, line_style, cap_style, join_style);
-    XSetFillStyle(display, gc, FillSolid);
-
-    Colormap screen_colormap = DefaultColormap(display, DefaultScreen(display));
-    XColor c;
-#define XColorDef(col)                                        \
-    XAllocNamedColor(display, screen_colormap, #col, &c, &c); \
-    col##_pixel = c.pixel;
-    XColorDef(red);
-    XColorDef(orange);
-    XColorDef(forestgreen);
-    XColorDef(blue);
-#undef XColorDef
 
     setField(-3000, -3000, 3000, 3000);  // 仮で適当なサイズのフィールドを設定
 
-    win_thread = std::make_optional<std::thread>([this]() { winThread(); });
-    pos_thread
-        = std::make_optional<std::thread>([this]() { posThread(pos_history, orange_pixel); });
-    locus_thread
-        = std::make_optional<std::thread>([this]() { posThread(locus_history, blue_pixel); });
+    robot = robot_shape;
+    render_thread = std::make_optional<std::thread>([this]() { renderThread(); });
 }
 
 ViewMap::~ViewMap()
 {
-    if (v_display) {
-        std::lock_guard lock(x11_mutex);
-        Display* display = static_cast<Display*>(*v_display);
-        v_display = std::nullopt;
-        XCloseDisplay(display);
+    if (remote) {
+        return;
     }
-    pos_history.terminate();
-    locus_history.terminate();
-    pos_thread->join();
-    locus_thread->join();
-    win_thread->join();
+    terminated = true;
+    wakeup.interrupt();
+    if (render_thread) {
+        render_thread->join();
+    }
+    resetPixmap();
+    backend.reset();
 }
 
-void ViewMap::winThread()
+void ViewMap::renderThread()
 {
-    while (v_display) {
-        Display* display = static_cast<Display*>(*v_display);
+    auto last_frame = std::chrono::steady_clock::time_point{};
+    static int mouse_last_x, mouse_last_y;
+    static bool mouse_last_moved = false;
 
-        static int mouse_last_x, mouse_last_y;
-        static bool mouse_last_moved = false;
-        {
-            std::lock_guard lock(x11_mutex);
-            while (XPending(display)) {
-                XEvent ev;
-                XNextEvent(display, &ev);
-                switch (ev.type) {
-                case Expose:
-                    updateWindow();
-                    break;
-                case ConfigureNotify:  // 画面サイズが変わったとき
-                    if (win_width != ev.xconfigure.width || win_height != ev.xconfigure.height) {
-                        win_width = ev.xconfigure.width;
-                        win_height = ev.xconfigure.height;
-                    }
-                    break;
-                case MotionNotify:  // マウスドラッグ
-                    if (mouse_last_moved) {
-                        field_ofs_x += mouse_last_x - ev.xmotion.x;
-                        field_ofs_y += mouse_last_y - ev.xmotion.y;
-                        updateWindow();
-                    }
-                    mouse_last_x = ev.xmotion.x;
-                    mouse_last_y = ev.xmotion.y;
-                    mouse_last_moved = true;
-                    break;
-                case ButtonRelease:
-                    mouse_last_moved = false;
-                    break;
-                case ButtonPress:  // スクロール
-                    constexpr double zoom_rate = 1.1;
-                    if (ev.xbutton.button == 4
-                        && zoom * zoom_rate < win_height / field_height * 3) {
-                        zoom *= zoom_rate;
-                        field_ofs_x = static_cast<int>(
-                            round(field_ofs_x * zoom_rate + ev.xbutton.x * (zoom_rate - 1)));
-                        field_ofs_y = static_cast<int>(
-                            round(field_ofs_y * zoom_rate + ev.xbutton.y * (zoom_rate - 1)));
-                        resetPixmap();
-                        updateWindow();
-                    }
-                    if (ev.xbutton.button == 5
-                        && zoom / zoom_rate > win_height / field_height / 3) {
-                        zoom /= zoom_rate;
-                        field_ofs_x = static_cast<int>(
-                            round(field_ofs_x / zoom_rate - ev.xbutton.x * (zoom_rate - 1)));
-                        field_ofs_y = static_cast<int>(
-                            round(field_ofs_y / zoom_rate - ev.xbutton.y * (zoom_rate - 1)));
-                        resetPixmap();
-                        updateWindow();
-                    }
-                    break;
+    while (!terminated) {
+        commands.consumeAll([this](Command&& command) { applyCommand(std::move(command)); });
+        InputEvent ev;
+        while (backend->nextEvent(ev)) {
+            switch (ev.type) {
+            case InputEvent::Type::Redraw:
+                dirty = full_damage = true;
+                break;
+            case InputEvent::Type::Resize:  // 画面サイズが変わったとき
+                if (win_width != ev.x || win_height != ev.y) {
+                    win_width = ev.x;
+                    win_height = ev.y;
+                    dirty = full_damage = true;
+                }
+                break;
+            case InputEvent::Type::Drag:  // マウスドラッグ
+                if (mouse_last_moved) {
+                    field_ofs_x += mouse_last_x - ev.x;
+                    field_ofs_y += mouse_last_y - ev.y;
+                    dirty = full_damage = true;
+                }
+                mouse_last_x = ev.x;
+                mouse_last_y = ev.y;
+                mouse_last_moved = true;
+                break;
+            case InputEvent::Type::Release:
+                mouse_last_moved = false;
+                break;
+            case InputEvent::Type::ScrollUp:  // スクロール
+                if (zoom * zoom_rate < win_height / field_height * 3) {
+                    zoom_level++;
+                    zoom = fit_zoom * pow(zoom_rate, zoom_level);
+                    field_ofs_x =
+                        static_cast<int>(round(field_ofs_x * zoom_rate + ev.x * (zoom_rate - 1)));
+                    field_ofs_y =
+                        static_cast<int>(round(field_ofs_y * zoom_rate + ev.y * (zoom_rate - 1)));
+                    dirty = full_damage = true;
+                }
+                break;
+            case InputEvent::Type::ScrollDown:
+                if (zoom / zoom_rate > win_height / field_height / 3) {
+                    zoom_level--;
+                    zoom = fit_zoom * pow(zoom_rate, zoom_level);
+                    field_ofs_x =
+                        static_cast<int>(round(field_ofs_x / zoom_rate - ev.x * (zoom_rate - 1)));
+                    field_ofs_y =
+                        static_cast<int>(round(field_ofs_y / zoom_rate - ev.y * (zoom_rate - 1)));
+                    dirty = full_damage = true;
                 }
+                break;
             }
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    }
-}
 
-void ViewMap::posThread(PositionHistory& history, unsigned long pixel)
-{
-    while (v_display) {
-        // 軌跡を描画
-        auto [last, next] = history.waitPopLastNext();
-        // lastはoptional<Pos>, nextはPos
-        if (!last || next != *last) {
-            std::lock_guard lock(x11_mutex);
-            if (last) {
-                drawFieldLine_impl(next, *last, pixel);
+        // 溜まった軌跡は画面に出すときにまとめてタイルに描く
+        // frame_rateより速くは更新しない
+        auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1 / frame_rate.load()));
+        auto now = std::chrono::steady_clock::now();
+        wakeup.prepare();
+        if (!commands.empty()) {
+            wakeup.finish();
+            continue;
+        }
+        bool pending = dirty || pos_history.pending() || locus_history.pending()
+                       || robot_state.version() != drawn_state_version;
+        if (pending && now >= last_frame + period) {
+            wakeup.finish();
+            if (pos_history.popAll() < pos_history.history.end()) {
+                dirty = true;
+            }
+            if (locus_history.popAll() < locus_history.history.end()) {
+                dirty = true;
+            }
+            if (robot_state.version() != drawn_state_version) {
+                dirty = true;
+            }
+            if (dirty) {
+                dirty = false;
+                updateWindow();
             }
-            updateWindow();
-            // flush();
+            last_frame = now;
+            continue;
+        }
+
+        // 画面のイベントか、他のスレッドからの通知か、次のフレームまで寝る
+        int timeout_ms = -1;
+        if (pending) {
+            timeout_ms = static_cast<int>(
+                std::chrono::ceil<std::chrono::milliseconds>(last_frame + period - now).count());
+        } else if (clock_driven) {
+            timeout_ms =
+                static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(period).count());
+        }
+        // headlessのときはfd()が-1(pollは負のfdを無視する)
+        std::array<pollfd, 2> fds = {{{backend->fd(), POLLIN, 0}, {wakeup.fd(), POLLIN, 0}}};
+        poll(fds.data(), fds.size(), timeout_ms);
+        wakeup.finish();
+        if (fds[1].revents & POLLIN) {
+            wakeup.drain();
         }
     }
 }
 
 void ViewMap::updatePos(const Pos& pos, const Pos& vel)
 {
-    pos_history.push(pos);
-    this->vel_x = vel.x;
-    this->vel_y = vel.y;
-    // this->omega = vel.th;
+    storePos(pos, vel, true);
 }
 void ViewMap::resetPos(const Pos& pos)
 {
+    if (remote) {
+        remote->push(remote_reset_pos, pos.x, pos.y, pos.th);
+        return;
+    }
+    last_state.pos = pos;
+    last_state.valid = true;
+    robot_state.store(last_state);
     pos_history.reset(pos);
+    wakeup.notify();
 }
 void ViewMap::updateLocus(const Pos& pos)
 {
-    locus_history.push(pos);
+    storeLocus(pos, true);
 }
 void ViewMap::resetLocus(const Pos& pos)
 {
+    if (remote) {
+        remote->push(remote_reset_locus, pos.x, pos.y, pos.th);
+        return;
+    }
     locus_history.reset(pos);
+    wakeup.notify();
+}
+// 描画スレッドがframe_rateごとに見に行くなら、起こさない(fenceとeventfdへのwriteをしない)
+void ViewMap::updatePosRT(const Pos& pos, const Pos& vel)
+{
+    storePos(pos, vel, !clock_driven);
+}
+void ViewMap::updateLocusRT(const Pos& pos)
+{
+    storeLocus(pos, !clock_driven);
+}
+void ViewMap::setFrameRate(double fps)
+{
+    if (remote) {
+        remote->send(remote_frame_rate, fps);
+    } else if (fps > 0) {
+        frame_rate = fps;
+        wakeup.notify();
+    }
+}
+
+void ViewMap::setLayerVisible(Layer layer, bool visible)
+{
+    if (remote) {
+        remote->send(remote_layer_visible, static_cast<int>(layer), visible);
+        return;
+    }
+    commands.push(LayerVisibility{layer, visible});
+    wakeup.notify();
 }
 
 void ViewMap::setField(double min_x, double min_y, double max_x, double max_y)
 {
-    field_min_x = min_x;
-    field_min_y = min_y;
-    field_max_x = max_x;
-    field_max_y = max_y;
-    resetFieldZoom();
-    {
-        std::lock_guard lock(x11_mutex);
-        resetPixmap();
-        updateWindow();
-        // flush();
+    if (remote) {
+        remote->send(remote_field_range, min_x, min_y, max_x, max_y);
+        return;
     }
+    commands.push(FieldRange{min_x, min_y, max_x, max_y});
+    wakeup.notify();
 }
 void ViewMap::drawFieldLine(double x1, double y1, double x2, double y2)
 {
-    LineData ld{{x1, y1}, {x2, y2}};
-    field_lines.push_back(ld);
-    {
-        std::lock_guard lock(x11_mutex);
-        drawFieldLine_impl(ld, black_pixel);
-        updateWindow();
-        // flush();
+    if (remote) {
+        remote->send(remote_field_line, x1, y1, x2, y2);
+        return;
     }
+    commands.push(LineData{{x1, y1}, {x2, y2}});
+    wakeup.notify();
 }
 void ViewMap::drawFieldArc(double x, double y, double r, double a1, double a2)
 {
-    ArcData ad{x, y, r, a1, a2};
-    field_arcs.push_back(ad);
-    {
-        std::lock_guard lock(x11_mutex);
-        drawFieldArc_impl(ad, black_pixel);
-        updateWindow();
-        // flush();
+    if (remote) {
+        remote->send(remote_field_arc, x, y, r, a1, a2);
+        return;
     }
+    commands.push(ArcData{x, y, r, a1, a2});
+    wakeup.notify();
+}
+void ViewMap::setRobot(
+    const std::vector<Pos>& wheels, double wheel_radius, const std::vector<Pos>& machine)
+{
+    robot_shape = {wheels, wheel_radius, machine};
+    sendRobotShape();
+}
+void ViewMap::setWheels(const std::vector<Pos>& wheels)
+{
+    robot_shape.wheels = wheels;
+    sendRobotShape();
+}
+void ViewMap::setWheelRadius(double wheel_radius)
+{
+    robot_shape.wheel_radius = wheel_radius;
+    sendRobotShape();
+}
+void ViewMap::setMachine(const std::vector<Pos>& machine)
+{
+    robot_shape.machine = machine;
+    sendRobotShape();
 }
 
 // private
 
+void ViewMap::sendRobotShape()
+{
+    if (remote) {
+        remote->send(remote_robot_begin, robot_shape.wheel_radius);
+        for (const Pos& w : robot_shape.wheels) {
+            remote->send(remote_robot_wheel, w.x, w.y, w.th);
+        }
+        for (const Pos& m : robot_shape.machine) {
+            remote->send(remote_robot_machine, m.x, m.y, m.th);
+        }
+        remote->send(remote_robot_end);
+        return;
+    }
+    commands.push(robot_shape);
+    wakeup.notify();
+}
+
+void ViewMap::storePos(const Pos& pos, const Pos& vel, bool notify)
+{
+    if (remote) {
+        remote->push(XVIEWMAP_RECORD_FIELDMAP, pos.x, pos.y, pos.th, vel.x, vel.y, vel.th);
+        return;
+    }
+    last_state = {pos, vel, true};
+    robot_state.store(last_state);
+    pos_history.push(pos);
+    if (notify) {
+        wakeup.notify();
+    }
+}
+void ViewMap::storeLocus(const Pos& pos, bool notify)
+{
+    if (remote) {
+        remote->push(XVIEWMAP_RECORD_LOCUSMAP, pos.x, pos.y, pos.th);
+        return;
+    }
+    locus_history.push(pos);
+    if (notify) {
+        wakeup.notify();
+    }
+}
+
+void ViewMap::applyCommand(Command&& command)
+{
+    if (auto range = std::get_if<FieldRange>(&command)) {
+        field_min_x = range->min_x;
+        field_min_y = range->min_y;
+        field_max_x = range->max_x;
+        field_max_y = range->max_y;
+        resetFieldZoom();
+        resetPixmap();
+        full_damage = true;
+    } else if (auto ld = std::get_if<LineData>(&command)) {
+        field_lines.push_back(*ld);
+        field_line_grid.insert(std::min(ld->first.x, ld->second.x),
+            std::min(ld->first.y, ld->second.y), std::max(ld->first.x, ld->second.x),
+            std::max(ld->first.y, ld->second.y), field_lines.size());
+    } else if (auto ad = std::get_if<ArcData>(&command)) {
+        field_arcs.push_back(*ad);
+        field_arc_grid.insert(
+            ad->x - ad->r, ad->y - ad->r, ad->x + ad->r, ad->y + ad->r, field_arcs.size() - 1);
+    } else if (auto shape = std::get_if<RobotShape>(&command)) {
+        robot = std::move(*shape);
+    } else if (auto lv = std::get_if<LayerVisibility>(&command)) {
+        // タイルはそのままで重ね直すだけ
+        layer_visible[static_cast<int>(lv->layer)] = lv->visible;
+        full_damage = true;
+    }
+    dirty = true;
+}
+
 void ViewMap::resetFieldZoom()
 {
     // フィールド幅と高さから拡大率と位置を調整
@@ -249,6 +454,8 @@ void ViewMap::resetFieldZoom()
         // win_height = field_height * zoom;
         field_ofs_y = static_cast<int>(round(-(win_height - field_height * zoom) / 2));
     }
+    fit_zoom = zoom;
+    zoom_level = 0;
 }
 int ViewMap::xFieldToWindow(double x)
 {
@@ -259,146 +466,658 @@ int ViewMap::yFieldToWindow(double y)
     return static_cast<int>(round((field_max_y - y) * zoom));
 }
 
-void ViewMap::flush()
-{
-    if (v_display) {
-        Display* display = static_cast<Display*>(*v_display);
-        XFlush(display);
-    }
-}
 void ViewMap::updateWindow()
 {
-    if (v_display) {
-        Display* display = static_cast<Display*>(*v_display);
-        GC gc = static_cast<GC>(v_gc);
+    // 画面にかかるタイルを集める
+    int tx_begin = floorDiv(field_ofs_x, tile_size);
+    int tx_end = floorDiv(field_ofs_x + win_width - 1, tile_size) + 1;
+    int ty_begin = floorDiv(field_ofs_y, tile_size);
+    int ty_end = floorDiv(field_ofs_y + win_height - 1, tile_size) + 1;
+    std::vector<Tile*> visible;
+    for (int ty = ty_begin; ty < ty_end; ty++) {
+        for (int tx = tx_begin; tx < tx_end; tx++) {
+            TileKey key{zoom_level, tx, ty};
+            Tile* tile = tiles.find(key);
+            if (!tile) {
+                Tile new_tile;
+                for (auto& mask : new_tile.masks) {
+                    mask = backend->createMask(tile_size, tile_size);
+                }
+                new_tile.tx = tx;
+                new_tile.ty = ty;
+                tile = &tiles.insert(key, new_tile);
+            }
+            visible.push_back(tile);
+        }
+    }
+    // 新しいタイルやresetされた軌跡のレイヤーはまず粗い軌跡で描いて(preview)すぐ出し、
+    // 決まった時間内で正確に描き直していく(残りは次のフレームで続ける)
+    // ズームし直すと前の段階のタイルはvisibleに入らなくなるので、そのまま描き直しも止まる
+    double exact_error = 0.5 / zoom, preview_error = preview_pixels / zoom;
+    std::vector<Tile*> preview;
+    for (Tile* tile : visible) {
+        bool has_preview = false;
+        for (int layer = pos_layer; layer < tile_layers; layer++) {
+            if (layerOutdated(*tile, layer)) {
+                tile->preview[layer] = true;
+                tile->initialized[layer] = false;
+            }
+            has_preview = has_preview || tile->preview[layer];
+        }
+        if (has_preview) {
+            preview.push_back(tile);
+        }
+    }
+    auto deadline = std::chrono::steady_clock::now()
+                    + std::chrono::duration<double>(rasterize_budget / frame_rate.load());
+    rasterizeTiles(visible, exact_error, false);
+    rasterizeTiles(preview, preview_error, true);
+    std::size_t step = raster_pool ? raster_batch : 1;
+    for (std::size_t i = 0; i < preview.size(); i += step) {
+        // 少なくとも1回は進める
+        if (i > 0 && std::chrono::steady_clock::now() >= deadline) {
+            dirty = true;
+            break;
+        }
+        std::vector<Tile*> batch(
+            preview.begin() + i, preview.begin() + std::min(i + step, preview.size()));
+        for (Tile* tile : batch) {
+            for (int layer = pos_layer; layer < tile_layers; layer++) {
+                if (tile->preview[layer]) {
+                    tile->preview[layer] = false;
+                    tile->initialized[layer] = false;
+                }
+            }
+        }
+        if (raster_pool) {
+            rasterizeSoftware(batch, exact_error);
+        } else {
+            rasterizeTiles(batch, exact_error, false);
+        }
+    }
 
-        // ロボット無い状態のフィールドを画面にコピー
-        XCopyArea(
-            display, *field_p, win, gc, field_ofs_x, field_ofs_y, win_width, win_height, 0, 0);
+    // 前に描いたロボットと今のロボットの範囲も出し直す
+    drawn_state_version = robot_state.version();
+    RobotState state = robot_state.load();
+    bool robot_visible = state.valid && layer_visible[static_cast<int>(Layer::Robot)];
+    Rect new_robot_rect = robot_visible ? robotRect(state) : Rect{};
+    damage({std::min(robot_rect.x1, new_robot_rect.x1), std::min(robot_rect.y1, new_robot_rect.y1),
+        std::max(robot_rect.x2, new_robot_rect.x2), std::max(robot_rect.y2, new_robot_rect.y2)});
+    robot_rect = new_robot_rect;
+    if (full_damage) {
+        damaged.assign(1, {0, 0, win_width, win_height});
+        full_damage = false;
+    }
 
-        auto pos = pos_history.getNow();
-        if (pos) {
-            // ロボットの外形描画
-            for (std::size_t i = 0; i < machine.size(); i++) {
-                drawWinLine_impl(
-                    *pos + machine[i], *pos + machine[(i + 1) % machine.size()], red_pixel);
+    // ロボット無い状態のフィールドを、出し直す範囲だけ画面に重ねる
+    // 下から壁など、posの軌跡、locusの軌跡の順
+    const Palette& palette = backend->palette();
+    std::array<unsigned long, tile_layers> colors = {palette.black, palette.orange, palette.blue};
+    backend->beginFrame();
+    for (const Rect& r : damaged) {
+        backend->fillRect(
+            backend->screen(), r.x1, r.y1, r.x2 - r.x1, r.y2 - r.y1, palette.white);
+        for (int layer = 0; layer < tile_layers; layer++) {
+            if (!layer_visible[layer]) {
+                continue;
             }
-            // オムニ描画
-            for (const auto& wheel : wheels) {
-                drawWinLine_impl((*pos + wheel).x - wheel_radius * cos(pos->th + wheel.th),
-                    (*pos + wheel).y - wheel_radius * sin(pos->th + wheel.th),
-                    (*pos + wheel).x + wheel_radius * cos(pos->th + wheel.th),
-                    (*pos + wheel).y + wheel_radius * sin(pos->th + wheel.th), red_pixel);
+            for (Tile* tile : visible) {
+                int x = tile->tx * tile_size - field_ofs_x, y = tile->ty * tile_size - field_ofs_y;
+                int x1 = std::max(r.x1, x), y1 = std::max(r.y1, y);
+                int x2 = std::min(r.x2, x + tile_size), y2 = std::min(r.y2, y + tile_size);
+                if (x1 < x2 && y1 < y2) {
+                    backend->blit(tile->masks[layer], x1 - x, y1 - y, x2 - x1, y2 - y1, x1, y1,
+                        colors[layer]);
+                }
             }
-
-            // 速度ベクトル描画
-            drawWinLine_impl(pos->x, pos->y, pos->x + vel_x, pos->y + vel_y, forestgreen_pixel);
-            /*
-            double vel_angle = atan2(vel_y, vel_x);
-            // 矢印の先っぽ
-            drawWinLine_impl(
-                pos->x + vel_x - 0.3 * cos(vel_angle + 3.14 / 6),
-                pos->y + vel_y - 0.3 * sin(vel_angle + 3.14 / 6),
-                pos->x + vel_x,
-                pos->y + vel_y,
-                forestgreen_pixel);
-            drawWinLine_impl(
-                pos->x + vel_x - 0.3 * cos(vel_angle - 3.14 / 6),
-                pos->y + vel_y - 0.3 * sin(vel_angle - 3.14 / 6),
-                pos->x + vel_x,
-                pos->y + vel_y,
-                forestgreen_pixel);
-            */
         }
+    }
+    damaged.clear();
+    tiles.evict(visible.size(), [&](Tile& tile) { releaseTile(tile); });
+
+    if (robot_visible) {
+        drawRobot_impl(state);
+    }
+    backend->present();
+}
 
-        // flush();
+void ViewMap::damage(const Rect& rect)
+{
+    Rect r = {std::max(rect.x1, 0), std::max(rect.y1, 0), std::min(rect.x2, win_width),
+        std::min(rect.y2, win_height)};
+    if (!full_damage && r.x1 < r.x2 && r.y1 < r.y2) {
+        damaged.push_back(r);
+    }
+}
+void ViewMap::damageTile(const Tile& tile, int x1, int y1, int x2, int y2)
+{
+    // 何も描いていなければRectの初期値(空)のまま来るので、足す前に切り取る
+    x1 = std::max(x1, 0);
+    y1 = std::max(y1, 0);
+    x2 = std::min(x2, tile_size);
+    y2 = std::min(y2, tile_size);
+    if (x1 >= x2 || y1 >= y2) {
+        return;
     }
+    int x = tile.tx * tile_size - field_ofs_x, y = tile.ty * tile_size - field_ofs_y;
+    damage({x + x1, y + y1, x + x2, y + y2});
 }
 
 void ViewMap::resetPixmap()
 {
-    if (v_display) {
-        Display* display = static_cast<Display*>(*v_display);
-        GC gc = static_cast<GC>(v_gc);
+    tiles.clear([&](Tile& tile) { releaseTile(tile); });
+}
+void ViewMap::releaseTile(Tile& tile)
+{
+    for (auto mask : tile.masks) {
+        backend->destroyMask(mask);
+    }
+}
 
-        if (field_p) {
-            XFreePixmap(display, *field_p);
+bool ViewMap::layerOutdated(const Tile& tile, int layer) const
+{
+    return !tile.initialized[layer]
+           || (layer == pos_layer && tile.pos_generation != pos_history.generation)
+           || (layer == locus_layer && tile.locus_generation != locus_history.generation);
+}
+void ViewMap::rasterizeTiles(const std::vector<Tile*>& target, double max_error, bool preview)
+{
+    if (target.empty()) {
+        return;
+    }
+
+    // targetを囲む長方形
+    int tx_begin = target.front()->tx, ty_begin = target.front()->ty;
+    int tx_last = tx_begin, ty_last = ty_begin;
+    for (Tile* tile : target) {
+        tx_begin = std::min(tx_begin, tile->tx);
+        ty_begin = std::min(ty_begin, tile->ty);
+        tx_last = std::max(tx_last, tile->tx);
+        ty_last = std::max(ty_last, tile->ty);
+    }
+    int tx_num = tx_last - tx_begin + 1;
+    int ty_num = ty_last - ty_begin + 1;
+
+    // フィールド座標→フィールド全体を1枚に描いたときの座標(丸める前)
+    auto toPixel = [&](double x, double y) {
+        return std::make_pair((field_max_y - y) * zoom, (field_max_x - x) * zoom);
+    };
+
+    struct TileBatch {
+        Tile* tile;
+        std::array<bool, tile_layers> on;  // 今回描くレイヤー
+        DrawBatch<Segment16> field, pos, locus;
+        DrawBatch<Arc16> arcs;
+        bool cleared = false;  // どれかのレイヤーを最初から描き直した
+        Rect drawn = {};       // 描き足した範囲(タイルの中の座標、線の太さ分広げる)
+        void extend(int x1, int y1, int x2, int y2)
+        {
+            drawn = {std::min({drawn.x1, x1 - 2, x2 - 2}), std::min({drawn.y1, y1 - 2, y2 - 2}),
+                std::max({drawn.x2, x1 + 3, x2 + 3}), std::max({drawn.y2, y1 + 3, y2 + 3})};
         }
-        int pm_width = static_cast<int>(round(field_width * zoom));
-        int pm_height = static_cast<int>(round(field_height * zoom));
+    };
+    std::vector<std::unique_ptr<TileBatch>> batches;
+    // 長方形の中の位置→batch(targetに無いところはnullptr)
+    std::vector<TileBatch*> batch_at(tx_num * ty_num, nullptr);
+    for (Tile* tile : target) {
+        std::array<bool, tile_layers> on;
+        bool cleared = false;
+        for (int layer = 0; layer < tile_layers; layer++) {
+            on[layer] = layer == field_layer ? !preview : tile->preview[layer] == preview;
+            if (!on[layer] || !layerOutdated(*tile, layer)) {
+                continue;
+            }
+            // 最初から描き直す
+            backend->fillRect(tile->masks[layer], 0, 0, tile_size, tile_size, 0);
+            tile->initialized[layer] = true;
+            cleared = true;
+            if (layer == field_layer) {
+                tile->lines_drawn = tile->arcs_drawn = 0;
+            } else if (layer == pos_layer) {
+                tile->pos_generation = pos_history.generation;
+                tile->pos_drawn = 0;
+            } else {
+                tile->locus_generation = locus_history.generation;
+                tile->locus_drawn = 0;
+            }
+        }
+        if (!on[field_layer] && !on[pos_layer] && !on[locus_layer]) {
+            continue;
+        }
+        // マスクには1で描き、色は画面に重ねるときに付ける
+        batches.push_back(std::unique_ptr<TileBatch>(
+            new TileBatch{tile, on, {*backend, tile->masks[field_layer], 1},
+                {*backend, tile->masks[pos_layer], 1}, {*backend, tile->masks[locus_layer], 1},
+                {*backend, tile->masks[field_layer], 1}, cleared}));
+        batch_at[(tile->ty - ty_begin) * tx_num + (tile->tx - tx_begin)] = batches.back().get();
+    }
+    if (batches.empty()) {
+        return;
+    }
 
-        field_p
-            = XCreatePixmap(display, win, pm_width, pm_height, DefaultDepth(display, screen_num));
-        flush();
+    // 線分がかかるタイルのうち、index番目をまだ描いていないものに追加する
+    auto addSegment = [&](double x1, double y1, double x2, double y2, int layer,
+                          DrawBatch<Segment16> TileBatch::*batch, std::size_t Tile::*drawn,
+                          std::size_t index) {
+        // 線の太さ分はみ出す
+        int bx_begin = std::max(
+            floorDiv(static_cast<int>(floor(std::min(x1, x2))) - 2, tile_size), tx_begin);
+        int bx_end = std::min(floorDiv(static_cast<int>(ceil(std::max(x1, x2))) + 2, tile_size) + 1,
+            tx_begin + tx_num);
+        int by_begin = std::max(
+            floorDiv(static_cast<int>(floor(std::min(y1, y2))) - 2, tile_size), ty_begin);
+        int by_end = std::min(floorDiv(static_cast<int>(ceil(std::max(y1, y2))) + 2, tile_size) + 1,
+            ty_begin + ty_num);
+        for (int by = by_begin; by < by_end; by++) {
+            for (int bx = bx_begin; bx < bx_end; bx++) {
+                TileBatch* tb_ptr = batch_at[(by - ty_begin) * tx_num + (bx - tx_begin)];
+                if (!tb_ptr || !tb_ptr->on[layer] || index < tb_ptr->tile->*drawn) {
+                    continue;
+                }
+                TileBatch& tb = *tb_ptr;
+                double ox = bx * tile_size, oy = by * tile_size;
+                double cx1 = x1 - ox, cy1 = y1 - oy, cx2 = x2 - ox, cy2 = y2 - oy;
+                // shortに収まらない分は切り取る
+                if (!clipSegment(cx1, cy1, cx2, cy2, -tile_size, 2 * tile_size)) {
+                    continue;
+                }
+                Segment16 seg = {static_cast<short>(round(cx1)), static_cast<short>(round(cy1)),
+                    static_cast<short>(round(cx2)), static_cast<short>(round(cy2))};
+                (tb.*batch).add(seg);
+                tb.extend(seg.x1, seg.y1, seg.x2, seg.y2);
+            }
+        }
+    };
 
-        XSetForeground(display, gc, white_pixel);
-        XFillRectangle(display, *field_p, gc, 0, 0, pm_width, pm_height);
+    // targetの左上を原点にした画面座標の線分を、かかるタイルのうちindex番目をまだ描いていないものに追加する
+    auto addSegment16 = [&](const Segment16& seg, int layer,
+                            DrawBatch<Segment16> TileBatch::*batch, std::size_t Tile::*drawn,
+                            std::size_t index) {
+        int bx_begin = std::max(floorDiv(std::min(seg.x1, seg.x2) - 2, tile_size), 0);
+        int bx_end = std::min(floorDiv(std::max(seg.x1, seg.x2) + 2, tile_size) + 1, tx_num);
+        int by_begin = std::max(floorDiv(std::min(seg.y1, seg.y2) - 2, tile_size), 0);
+        int by_end = std::min(floorDiv(std::max(seg.y1, seg.y2) + 2, tile_size) + 1, ty_num);
+        for (int by = by_begin; by < by_end; by++) {
+            for (int bx = bx_begin; bx < bx_end; bx++) {
+                TileBatch* tb = batch_at[by * tx_num + bx];
+                if (!tb || !tb->on[layer] || index < tb->tile->*drawn) {
+                    continue;
+                }
+                int ox = bx * tile_size, oy = by * tile_size;
+                (tb->*batch).add({static_cast<short>(seg.x1 - ox), static_cast<short>(seg.y1 - oy),
+                    static_cast<short>(seg.x2 - ox), static_cast<short>(seg.y2 - oy)});
+                tb->extend(seg.x1 - ox, seg.y1 - oy, seg.x2 - ox, seg.y2 - oy);
+            }
+        }
+    };
+    const FieldTransform area_transform = {field_max_x, field_max_y, zoom,
+        -static_cast<double>(tx_begin * tile_size), -static_cast<double>(ty_begin * tile_size)};
+    std::vector<Segment16> segments;
+    std::vector<std::uint8_t> outside;
 
-        // フィールド外枠
-        XPoint field_outside[] = {{0, 0}, {static_cast<short>(pm_width - 1), 0},
-            {static_cast<short>(pm_width - 1), static_cast<short>(pm_height - 1)},
-            {0, static_cast<short>(pm_height - 1)}, {0, 0}};
-        XSetForeground(display, gc, black_pixel);
-        XDrawLines(display, *field_p, gc, field_outside, 5, CoordModeOrigin);
-
-        // フィールドの壁など
-        for (const auto& ld : field_lines) {
-            drawFieldLine_impl(ld, black_pixel);
-        }
-        for (const auto& ad : field_arcs) {
-            drawFieldArc_impl(ad, black_pixel);
-        }
-        if (pos_history.history.size() >= 1) {
-            Pos last_c = pos_history.history[0];
-            for (auto& p : pos_history.history) {
-                drawFieldLine_impl(p, last_c, orange_pixel);
-                last_c = p;
+    // フィールド外枠(lines_drawnの0番目として扱う)
+    {
+        double w = round(field_width * zoom) - 1, h = round(field_height * zoom) - 1;
+        std::array<std::pair<double, double>, 5> corners = {
+            {{0, 0}, {w, 0}, {w, h}, {0, h}, {0, 0}}};
+        for (std::size_t i = 0; i + 1 < corners.size(); i++) {
+            addSegment(corners[i].first, corners[i].second, corners[i + 1].first,
+                corners[i + 1].second, field_layer, &TileBatch::field, &Tile::lines_drawn, 0);
+        }
+    }
+    // targetの範囲(フィールド座標、線の太さ分広げる)
+    double margin = 2 / zoom;
+    double area_min_x = field_max_x - (ty_begin + ty_num) * tile_size / zoom - margin;
+    double area_max_x = field_max_x - ty_begin * tile_size / zoom + margin;
+    double area_min_y = field_max_y - (tx_begin + tx_num) * tile_size / zoom - margin;
+    double area_max_y = field_max_y - tx_begin * tile_size / zoom + margin;
+    // レイヤーを描くタイルのどれかにまだ描いていない番号の最小値
+    auto minDrawn = [&](int layer, std::size_t Tile::*drawn) {
+        std::size_t begin = std::numeric_limits<std::size_t>::max();
+        for (auto& tb : batches) {
+            if (tb->on[layer]) {
+                begin = std::min(begin, tb->tile->*drawn);
             }
         }
-        if (locus_history.history.size() >= 1) {
-            Pos last_c = locus_history.history[0];
-            for (auto& p : locus_history.history) {
-                drawFieldLine_impl(p, last_c, blue_pixel);
-                last_c = p;
+        return begin;
+    };
+    // 範囲内にあるものだけを見る
+    std::vector<SpatialGrid::Run> runs;
+
+    // フィールドの壁など(field_lines[i-1]をi番目として扱う)
+    field_line_grid.query(area_min_x, area_min_y, area_max_x, area_max_y,
+        minDrawn(field_layer, &Tile::lines_drawn), field_lines.size() + 1, runs);
+    for (auto [begin, end] : runs) {
+        for (std::size_t i = begin; i < end; i++) {
+            const LineData& ld = field_lines[i - 1];
+            auto [x1, y1] = toPixel(ld.first.x, ld.first.y);
+            auto [x2, y2] = toPixel(ld.second.x, ld.second.y);
+            addSegment(x1, y1, x2, y2, field_layer, &TileBatch::field, &Tile::lines_drawn, i);
+        }
+    }
+    field_arc_grid.query(area_min_x, area_min_y, area_max_x, area_max_y,
+        minDrawn(field_layer, &Tile::arcs_drawn), field_arcs.size(), runs);
+    std::vector<std::size_t> arc_indices;
+    for (auto [begin, end] : runs) {
+        for (std::size_t i = begin; i < end; i++) {
+            arc_indices.push_back(i);
+        }
+    }
+    for (std::size_t i : arc_indices) {
+        const ArcData& ad = field_arcs[i];
+        auto [left, top] = toPixel(ad.x + ad.r, ad.y + ad.r);
+        double size = ad.r * 2 * zoom;
+        for (auto& tb : batches) {
+            double ox = tb->tile->tx * tile_size, oy = tb->tile->ty * tile_size;
+            if (!tb->on[field_layer] || i < tb->tile->arcs_drawn || left - 2 > ox + tile_size || left + size + 2 < ox
+                || top - 2 > oy + tile_size || top + size + 2 < oy) {
+                continue;
+            }
+            tb->extend(static_cast<int>(floor(left - ox)), static_cast<int>(floor(top - oy)),
+                static_cast<int>(ceil(left + size - ox)), static_cast<int>(ceil(top + size - oy)));
+            if (left - ox >= -16384 && top - oy >= -16384 && size <= 32767) {
+                tb->arcs.add({static_cast<short>(round(left - ox)),
+                    static_cast<short>(round(top - oy)), static_cast<unsigned short>(round(size)),
+                    static_cast<unsigned short>(round(size)),
+                    static_cast<short>(round((ad.a1 + 90) * 64)),
+                    static_cast<short>(round((ad.a2 - ad.a1) * 64))});
+            } else {
+                // 大きすぎてArc16で表せないので折れ線で近似
+                int n = std::clamp(static_cast<int>(ad.r * zoom * (ad.a2 - ad.a1) / 360), 8, 4096);
+                for (int k = 0; k < n; k++) {
+                    double t1 = (ad.a1 + (ad.a2 - ad.a1) * k / n) * M_PI / 180;
+                    double t2 = (ad.a1 + (ad.a2 - ad.a1) * (k + 1) / n) * M_PI / 180;
+                    auto [x1, y1] = toPixel(ad.x + ad.r * cos(t1), ad.y + ad.r * sin(t1));
+                    auto [x2, y2] = toPixel(ad.x + ad.r * cos(t2), ad.y + ad.r * sin(t2));
+                    double cx1 = x1 - ox, cy1 = y1 - oy, cx2 = x2 - ox, cy2 = y2 - oy;
+                    if (clipSegment(cx1, cy1, cx2, cy2, -tile_size, 2 * tile_size)) {
+                        tb->field.add({static_cast<short>(round(cx1)),
+                            static_cast<short>(round(cy1)), static_cast<short>(round(cx2)),
+                            static_cast<short>(round(cy2))});
+                    }
+                }
             }
         }
     }
+    // 軌跡
+    // i番目の線分はhistory[i-1]とhistory[i]を結ぶ
+    auto addHistory = [&](const Trajectory& history, int layer,
+                          DrawBatch<Segment16> TileBatch::*batch, std::size_t Tile::*drawn) {
+        std::size_t begin = std::max(minDrawn(layer, drawn), history.begin() + 1);
+        if (begin >= history.end()) {
+            return;
+        }
+        history.querySegments(
+            area_min_x, area_min_y, area_max_x, area_max_y, begin, history.end(), runs);
+        auto addOne = [&](std::size_t i) {
+            Pos p1 = history[i - 1], p2 = history[i];
+            auto [x1, y1] = toPixel(p1.x, p1.y);
+            auto [x2, y2] = toPixel(p2.x, p2.y);
+            addSegment(x1, y1, x2, y2, layer, batch, drawn, i);
+        };
+        for (auto [run_begin, run_end] : runs) {
+            // run_begin-1番目の点から、chunkの中で連続している部分をまとめて変換する
+            history.forEachSpan(run_begin - 1, run_end,
+                [&](std::size_t first, const double* xs, const double* ys, std::size_t count) {
+                    if (first >= run_begin) {
+                        // chunkの境目の線分
+                        addOne(first);
+                    }
+                    if (count < 2) {
+                        return;
+                    }
+                    segments.resize(count - 1);
+                    outside.resize(count - 1);
+                    fieldToSegments(xs, ys, count, area_transform, 16384, segments.data(),
+                        outside.data());
+                    for (std::size_t k = 0; k + 1 < count; k++) {
+                        if (outside[k]) {
+                            addOne(first + k + 1);
+                        } else {
+                            addSegment16(segments[k], layer, batch, drawn, first + k + 1);
+                        }
+                    }
+                });
+        }
+    };
+    // ズーム段階ごとに使う間引き具合は決まっているので、タイルに描いた番号もそのまま使える
+    const Trajectory& pos_trajectory = pos_history.simplified(max_error);
+    const Trajectory& locus_trajectory = locus_history.simplified(max_error);
+    addHistory(pos_trajectory, pos_layer, &TileBatch::pos, &Tile::pos_drawn);
+    addHistory(locus_trajectory, locus_layer, &TileBatch::locus, &Tile::locus_drawn);
+
+    for (auto& tb : batches) {
+        tb->field.flush();
+        tb->arcs.flush();
+        tb->pos.flush();
+        tb->locus.flush();
+        if (tb->on[field_layer]) {
+            tb->tile->lines_drawn = field_lines.size() + 1;
+            tb->tile->arcs_drawn = field_arcs.size();
+        }
+        if (tb->on[pos_layer]) {
+            tb->tile->pos_drawn = pos_trajectory.end();
+        }
+        if (tb->on[locus_layer]) {
+            tb->tile->locus_drawn = locus_trajectory.end();
+        }
+        if (tb->cleared) {
+            damageTile(*tb->tile, 0, 0, tile_size, tile_size);
+        } else {
+            damageTile(*tb->tile, tb->drawn.x1, tb->drawn.y1, tb->drawn.x2, tb->drawn.y2);
+        }
+    }
 }
 
-void ViewMap::drawFieldLine_impl(double x1, double y1, double x2, double y2, unsigned long pixel)
+ViewMap::Rect ViewMap::robotRect(const RobotState& state)
 {
-    if (v_display) {
-        Display* display = static_cast<Display*>(*v_display);
-        GC gc = static_cast<GC>(v_gc);
-        XSetForeground(display, gc, pixel);
-        XDrawLine(display, *field_p, gc, yFieldToWindow(y1), xFieldToWindow(x1), yFieldToWindow(y2),
-            xFieldToWindow(x2));
+    // drawRobot_implで描く点を全部囲む(線の太さ分広げる)
+    Rect r;
+    auto extend = [&](double x, double y) {
+        int wx = -field_ofs_x + yFieldToWindow(y), wy = -field_ofs_y + xFieldToWindow(x);
+        r = {std::min(r.x1, wx - 2), std::min(r.y1, wy - 2), std::max(r.x2, wx + 3),
+            std::max(r.y2, wy + 3)};
+    };
+    const Pos& pos = state.pos;
+    for (const Pos& m : robot.machine) {
+        Pos p = pos + m;
+        extend(p.x, p.y);
     }
+    for (const auto& wheel : robot.wheels) {
+        Pos w = pos + wheel;
+        double c = robot.wheel_radius * cos(pos.th + wheel.th);
+        double s = robot.wheel_radius * sin(pos.th + wheel.th);
+        extend(w.x - c, w.y - s);
+        extend(w.x + c, w.y + s);
+    }
+    extend(pos.x, pos.y);
+    extend(pos.x + state.vel.x, pos.y + state.vel.y);
+    return r;
 }
-
-void ViewMap::drawWinLine_impl(double x1, double y1, double x2, double y2, unsigned long pixel)
+void ViewMap::drawRobot_impl(const RobotState& state)
 {
-    if (v_display) {
-        Display* display = static_cast<Display*>(*v_display);
-        GC gc = static_cast<GC>(v_gc);
-        XSetForeground(display, gc, pixel);
-        XDrawLine(display, win, gc, -field_ofs_x + yFieldToWindow(y1),
-            -field_ofs_y + xFieldToWindow(x1), -field_ofs_x + yFieldToWindow(y2),
-            -field_ofs_y + xFieldToWindow(x2));
+    Surface screen = backend->screen();
+    const Palette& palette = backend->palette();
+    const Pos& pos = state.pos;
+    auto toWin = [&](double x, double y) {
+        return Point16{static_cast<short>(-field_ofs_x + yFieldToWindow(y)),
+            static_cast<short>(-field_ofs_y + xFieldToWindow(x))};
+    };
+    if (!robot.machine.empty()) {
+        // ロボットの外形描画
+        DrawBatch<Point16> outline(*backend, screen, palette.red);
+        for (std::size_t i = 0; i <= robot.machine.size(); i++) {
+            Pos p = pos + robot.machine[i % robot.machine.size()];
+            outline.add(toWin(p.x, p.y));
+        }
+    }
+    {
+        // オムニ描画
+        DrawBatch<Segment16> omni(*backend, screen, palette.red);
+        for (const auto& wheel : robot.wheels) {
+            Pos w = pos + wheel;
+            double c = robot.wheel_radius * cos(pos.th + wheel.th);
+            double s = robot.wheel_radius * sin(pos.th + wheel.th);
+            Point16 p1 = toWin(w.x - c, w.y - s), p2 = toWin(w.x + c, w.y + s);
+            omni.add({p1.x, p1.y, p2.x, p2.y});
+        }
+    }
+    {
+        // 速度ベクトル描画
+        DrawBatch<Segment16> vel(*backend, screen, palette.forestgreen);
+        Point16 p1 = toWin(pos.x, pos.y), p2 = toWin(pos.x + state.vel.x, pos.y + state.vel.y);
+        vel.add({p1.x, p1.y, p2.x, p2.y});
     }
 }
 
-void ViewMap::drawFieldArc_impl(
-    double x, double y, double r, double a1, double a2, unsigned long pixel)
+void ViewMap::rasterizeSoftware(const std::vector<Tile*>& target, double max_error)
+{
+    // 描き直しが必要なレイヤーごとに1枚描く
+    std::vector<std::pair<Tile*, int>> jobs;
+    for (Tile* tile : target) {
+        for (int layer = 0; layer < tile_layers; layer++) {
+            if (layerOutdated(*tile, layer)) {
+                jobs.emplace_back(tile, layer);
+            }
+        }
+    }
+    if (jobs.empty()) {
+        return;
+    }
+    const Trajectory& pos_trajectory = pos_history.simplified(max_error);
+    const Trajectory& locus_trajectory = locus_history.simplified(max_error);
+    auto trajectoryOf = [&](int layer) {
+        return layer == pos_layer     ? &pos_trajectory
+               : layer == locus_layer ? &locus_trajectory
+                                      : nullptr;
+    };
+    // backendが一度に受け取れる枚数ずつ描いて送る
+    std::size_t capacity = std::min(backend->uploadSlots(), jobs.size());
+    std::vector<MaskImage*> images(capacity);
+    for (std::size_t begin = 0; begin < jobs.size(); begin += capacity) {
+        std::size_t n = std::min(capacity, jobs.size() - begin);
+        for (std::size_t i = 0; i < n; i++) {
+            auto [tile, layer] = jobs[begin + i];
+            images[i] = &backend->uploadImage(i, tile->masks[layer]);
+        }
+        raster_pool->parallelFor(n, [&](std::size_t i) {
+            auto [tile, layer] = jobs[begin + i];
+            drawTileSoftware(*tile, layer, *images[i], trajectoryOf(layer));
+        });
+        for (std::size_t i = 0; i < n; i++) {
+            auto [tile, layer] = jobs[begin + i];
+            backend->upload(i, tile->masks[layer]);
+            damageTile(*tile, 0, 0, tile_size, tile_size);
+            tile->initialized[layer] = true;
+            if (layer == field_layer) {
+                tile->lines_drawn = field_lines.size() + 1;
+                tile->arcs_drawn = field_arcs.size();
+            } else if (layer == pos_layer) {
+                tile->pos_generation = pos_history.generation;
+                tile->pos_drawn = pos_trajectory.end();
+            } else {
+                tile->locus_generation = locus_history.generation;
+                tile->locus_drawn = locus_trajectory.end();
+            }
+        }
+        backend->finishUpload();
+    }
+}
+// rasterizeTilesと同じものを1枚のタイルのレイヤーに最初から描く
+// 軌跡のレイヤーはtrajectoryを描く
+// 複数のスレッドから同時に呼ばれるので、読むだけ
+void ViewMap::drawTileSoftware(
+    const Tile& tile, int layer, MaskImage& image, const Trajectory* trajectory) const
 {
-    if (v_display) {
-        Display* display = static_cast<Display*>(*v_display);
-        GC gc = static_cast<GC>(v_gc);
-        XSetForeground(display, gc, pixel);
-        XDrawArc(display, *field_p, gc, yFieldToWindow(y + r), xFieldToWindow(x + r),
-            static_cast<int>(round(r * 2 * zoom)), static_cast<int>(round(r * 2 * zoom)),
-            static_cast<int>(round((a1 + 90) * 64)), static_cast<int>(round((a2 - a1) * 64)));
+    double ox = tile.tx * tile_size, oy = tile.ty * tile_size;
+    auto toTile = [&](double x, double y) {
+        return std::make_pair((field_max_y - y) * zoom - ox, (field_max_x - x) * zoom - oy);
+    };
+    image.fill(0);
+    // タイルの範囲(フィールド座標、線の太さ分広げる)
+    double margin = 2 / zoom;
+    double area_min_x = field_max_x - (oy + tile_size) / zoom - margin;
+    double area_max_x = field_max_x - oy / zoom + margin;
+    double area_min_y = field_max_y - (ox + tile_size) / zoom - margin;
+    double area_max_y = field_max_y - ox / zoom + margin;
+    std::vector<SpatialGrid::Run> runs;
+
+    if (layer == field_layer) {
+        // フィールド外枠
+        double w = round(field_width * zoom) - 1, h = round(field_height * zoom) - 1;
+        std::array<std::pair<double, double>, 5> corners = {
+            {{0, 0}, {w, 0}, {w, h}, {0, h}, {0, 0}}};
+        for (std::size_t i = 0; i + 1 < corners.size(); i++) {
+            image.drawLine(corners[i].first - ox, corners[i].second - oy,
+                corners[i + 1].first - ox, corners[i + 1].second - oy, 1);
+        }
+        field_line_grid.query(
+            area_min_x, area_min_y, area_max_x, area_max_y, 1, field_lines.size() + 1, runs);
+        for (auto [begin, end] : runs) {
+            for (std::size_t i = begin; i < end; i++) {
+                auto [x1, y1] = toTile(field_lines[i - 1].first.x, field_lines[i - 1].first.y);
+                auto [x2, y2] = toTile(field_lines[i - 1].second.x, field_lines[i - 1].second.y);
+                image.drawLine(x1, y1, x2, y2, 1);
+            }
+        }
+        field_arc_grid.query(
+            area_min_x, area_min_y, area_max_x, area_max_y, 0, field_arcs.size(), runs);
+        for (auto [begin, end] : runs) {
+            for (std::size_t i = begin; i < end; i++) {
+                const ArcData& ad = field_arcs[i];
+                auto [cx, cy] = toTile(ad.x, ad.y);
+                image.drawArc(cx, cy, ad.r * zoom, ad.a1 + 90, ad.a2 + 90, 1);
+            }
+        }
+        return;
+    }
+
+    const Trajectory& history = *trajectory;
+    if (history.end() - history.begin() < 2) {
+        return;
+    }
+    const FieldTransform tile_transform = {field_max_x, field_max_y, zoom, -ox, -oy};
+    std::vector<Segment16> segments;
+    std::vector<std::uint8_t> outside;
+    auto drawOne = [&](std::size_t i) {
+        Pos p1 = history[i - 1], p2 = history[i];
+        auto [x1, y1] = toTile(p1.x, p1.y);
+        auto [x2, y2] = toTile(p2.x, p2.y);
+        image.drawLine(x1, y1, x2, y2, 1);
+    };
+    history.querySegments(area_min_x, area_min_y, area_max_x, area_max_y, history.begin() + 1,
+        history.end(), runs);
+    for (auto [run_begin, run_end] : runs) {
+        history.forEachSpan(run_begin - 1, run_end,
+            [&](std::size_t first, const double* xs, const double* ys, std::size_t count) {
+                if (first >= run_begin) {
+                    drawOne(first);
+                }
+                if (count < 2) {
+                    return;
+                }
+                segments.resize(count - 1);
+                outside.resize(count - 1);
+                fieldToSegments(
+                    xs, ys, count, tile_transform, 16384, segments.data(), outside.data());
+                for (std::size_t k = 0; k + 1 < count; k++) {
+                    if (outside[k]) {
+                        drawOne(first + k + 1);
+                    } else {
+                        const Segment16& seg = segments[k];
+                        image.drawLine(seg.x1, seg.y1, seg.x2, seg.y2, 1);
+                    }
+                }
+            });
     }
 }
 
+bool ViewMap::saveFrame(const std::string& path)
+{
+    if (remote) {
+        std::cerr << "[XViewMap] saveFrame is not available with out_of_process" << std::endl;
+        return false;
+    }
+    return backend->saveFrame(path);
+}
 }  // namespace XViewMap
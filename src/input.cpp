@@ -0,0 +1,117 @@
+#include "input.hpp"
+#include <charconv>
+#include <cstring>
+
+namespace XViewMap
+{
+namespace
+{
+bool parseDouble(std::string_view s, double& v)
+{
+    // std::stodと同様に先頭の+は許す
+    if (!s.empty() && s.front() == '+') {
+        s.remove_prefix(1);
+    }
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+    return ec == std::errc() && ptr == s.data() + s.size();
+}
+
+// リトルエンディアンで読む
+std::uint64_t readU64(const char* p)
+{
+    std::uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = v << 8 | static_cast<unsigned char>(p[i]);
+    }
+    return v;
+}
+std::uint16_t readU16(const char* p)
+{
+    return static_cast<std::uint16_t>(
+        static_cast<unsigned char>(p[0]) | static_cast<unsigned char>(p[1]) << 8);
+}
+double readF64(const char* p)
+{
+    std::uint64_t bits = readU64(p);
+    double v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+}  // namespace
+
+InputLine parseInputLine(std::string_view line)
+{
+    // 必要なのは先頭8個まで
+    std::array<std::string_view, 8> tokens;
+    std::size_t num_tokens = 0;
+    std::size_t i = 0;
+    while (i < line.size() && num_tokens < tokens.size()) {
+        while (i < line.size() && (line[i] == ' ' || line[i] == '\t')) {
+            i++;
+        }
+        std::size_t start = i;
+        while (i < line.size() && line[i] != ' ' && line[i] != '\t') {
+            i++;
+        }
+        if (i > start) {
+            tokens[num_tokens++] = line.substr(start, i - start);
+        }
+    }
+
+    InputLine in;
+    if (!line.empty() && line.front() == '\0') {
+        // 途中で切れたバイナリのレコード
+        in.type = InputLine::Type::Malformed;
+        return in;
+    }
+    if (num_tokens < 2) {
+        return in;
+    }
+    if (tokens[1] == "[FieldMap]") {
+        in.type = InputLine::Type::Malformed;
+        if (num_tokens >= 8 && parseDouble(tokens[2], in.pos.x) && parseDouble(tokens[3], in.pos.y)
+            && parseDouble(tokens[4], in.pos.th) && parseDouble(tokens[5], in.vel.x)
+            && parseDouble(tokens[6], in.vel.y) && parseDouble(tokens[7], in.vel.th)) {
+            in.type = InputLine::Type::FieldMap;
+        }
+    } else if (tokens[1] == "[LocusMap]") {
+        in.type = InputLine::Type::Malformed;
+        if (num_tokens >= 5 && parseDouble(tokens[2], in.pos.x) && parseDouble(tokens[3], in.pos.y)
+            && parseDouble(tokens[4], in.pos.th)) {
+            in.type = InputLine::Type::LocusMap;
+        }
+    }
+    return in;
+}
+
+InputRecord decodeInputRecord(const char* record)
+{
+    InputRecord r;
+    if (std::memcmp(record, XVIEWMAP_RECORD_MAGIC, XVIEWMAP_RECORD_MAGIC_SIZE) != 0) {
+        return r;
+    }
+    r.kind = readU16(record + 4);
+    r.channel = readU16(record + 6);
+    r.timestamp = readU64(record + 8);
+    for (std::size_t i = 0; i < r.values.size(); i++) {
+        r.values[i] = readF64(record + 16 + i * 8);
+    }
+    return r;
+}
+InputLine parseInputRecord(const char* record)
+{
+    InputRecord r = decodeInputRecord(record);
+    InputLine in;
+    in.type = InputLine::Type::Malformed;
+    in.channel = r.channel;
+    in.timestamp = r.timestamp;
+    in.pos = {r.values[0], r.values[1], r.values[2]};
+    in.vel = {r.values[3], r.values[4], r.values[5]};
+    if (r.kind == XVIEWMAP_RECORD_FIELDMAP) {
+        in.type = InputLine::Type::FieldMap;
+    } else if (r.kind == XVIEWMAP_RECORD_LOCUSMAP) {
+        in.type = InputLine::Type::LocusMap;
+    }
+    return in;
+}
+}  // namespace XViewMap
@@ -0,0 +1,131 @@
+#pragma once
+#include <position.hpp>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <unistd.h>
+#include <xviewmap_record.h>
+
+namespace XViewMap
+{
+// Lighthouse互換の1行
+//   0 [FieldMap] x y th vx vy omega
+//   0 [LocusMap] x y th
+// またはxviewmap_record.hのバイナリのレコード1個
+struct InputLine {
+    enum class Type {
+        FieldMap,
+        LocusMap,
+        Other,      // 無関係な行(そのまま出力する)
+        Malformed,  // タグはあるが数値が足りない・読めない
+    };
+    Type type = Type::Other;
+    Pos pos, vel;
+    std::uint16_t channel = 0;    // バイナリのときだけ
+    std::uint64_t timestamp = 0;  // バイナリのときだけ
+};
+// lineは改行を含まない1行
+InputLine parseInputLine(std::string_view line);
+// recordはXVIEWMAP_RECORD_SIZE byte
+InputLine parseInputRecord(const char* record);
+// レコードをkindによらずそのまま読む(magicが違えばkind=0)
+struct InputRecord {
+    std::uint16_t kind = 0, channel = 0;
+    std::uint64_t timestamp = 0;
+    std::array<double, 6> values = {};
+};
+InputRecord decodeInputRecord(const char* record);
+
+// fdからブロック単位で読み込み、1行ずつstring_viewで渡す
+// 行の先頭が\0ならそこからはバイナリのレコードとして渡す(テキストと混ざっていてもよい)
+// 行ごとのメモリ確保はしない
+class InputReader
+{
+    int fd;
+    std::array<char, 64 * 1024> buf;
+    std::size_t begin = 0, end = 0;
+
+public:
+    explicit InputReader(int fd) : fd(fd) {}
+
+    // 1ブロック読んで、揃った行ごとにon_line(std::string_view)、
+    // レコードごとにon_record(const char*)を呼ぶ
+    // 渡したものはバッファを指しているので次の呼び出しまでしか有効でない
+    // EOFまたはエラーでfalse(最後の途中までのレコードは行として渡し、Malformedになる)
+    template <typename F, typename G>
+    bool read(F&& on_line, G&& on_record)
+    {
+        if (begin > 0) {
+            std::memmove(buf.data(), buf.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+        if (end == buf.size()) {
+            // 改行が来ないまま溢れた行はそこで区切る
+            on_line(std::string_view(buf.data(), end));
+            end = 0;
+        }
+        ssize_t n;
+        do {
+            n = ::read(fd, buf.data() + end, buf.size() - end);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            if (end > 0) {
+                on_line(trimCR(std::string_view(buf.data(), end)));
+                end = 0;
+            }
+            return false;
+        }
+        end += static_cast<std::size_t>(n);
+        begin = split(buf.data(), end, on_line, on_record);
+        return true;
+    }
+
+    // dataのうち揃っている行・レコードを渡し、渡した分のbyte数を返す
+    template <typename F, typename G>
+    static std::size_t split(const char* data, std::size_t size, F&& on_line, G&& on_record)
+    {
+        std::size_t begin = 0;
+        while (begin < size) {
+            if (data[begin] == '\0') {
+                if (size - begin < XVIEWMAP_RECORD_SIZE) {
+                    break;
+                }
+                on_record(data + begin);
+                begin += XVIEWMAP_RECORD_SIZE;
+                continue;
+            }
+            auto nl = static_cast<const char*>(std::memchr(data + begin, '\n', size - begin));
+            if (!nl) {
+                break;
+            }
+            std::size_t len = static_cast<std::size_t>(nl - (data + begin));
+            on_line(trimCR(std::string_view(data + begin, len)));
+            begin += len + 1;
+        }
+        return begin;
+    }
+    // 1つで完結しているもの(UDPのデータグラムなど)を全部渡す
+    // 最後の行は改行が無くてもよい
+    template <typename F, typename G>
+    static void splitAll(const char* data, std::size_t size, F&& on_line, G&& on_record)
+    {
+        std::size_t begin = split(data, size, on_line, on_record);
+        if (begin < size) {
+            on_line(trimCR(std::string_view(data + begin, size - begin)));
+        }
+    }
+
+private:
+    static std::string_view trimCR(std::string_view line)
+    {
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        return line;
+    }
+};
+}  // namespace XViewMap
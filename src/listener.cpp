@@ -0,0 +1,192 @@
+#include "listener.hpp"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace XViewMap
+{
+Listener::~Listener()
+{
+    while (!connections.empty()) {
+        close(connections.begin()->first);
+    }
+    if (unix_fd >= 0) {
+        ::close(unix_fd);
+        unlink(unix_path.c_str());
+    }
+    if (udp_fd >= 0) {
+        ::close(udp_fd);
+    }
+    if (epoll_fd >= 0) {
+        ::close(epoll_fd);
+    }
+}
+
+#ifdef __linux__
+bool Listener::addFd(int fd)
+{
+    if (epoll_fd < 0) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            std::cerr << "[XViewMap] epoll_create1 failed: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        std::cerr << "[XViewMap] epoll_ctl failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Listener::listenUnix(const std::string& path)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "[XViewMap] Socket path too long: " << path << std::endl;
+        return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cerr << "[XViewMap] socket failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    // 前に落ちたときのソケットファイルが残っていれば消す
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 64) != 0) {
+        std::cerr << "[XViewMap] Failed to listen on " << path << ": " << std::strerror(errno)
+                  << std::endl;
+        ::close(fd);
+        return false;
+    }
+    unix_fd = fd;
+    unix_path = path;
+    return addFd(fd);
+}
+
+bool Listener::listenUdp(int port)
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<std::uint16_t>(port));
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cerr << "[XViewMap] socket failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "[XViewMap] Failed to bind UDP port " << port << ": "
+                  << std::strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+    udp_fd = fd;
+    udp_buf.resize(udp_batch * udp_size);
+    return addFd(fd);
+}
+
+void Listener::wait()
+{
+    ready.clear();
+    epoll_event events[64];
+    int n = epoll_wait(epoll_fd, events, 64, 0);
+    for (int i = 0; i < n; i++) {
+        ready.push_back(events[i].data.fd);
+    }
+}
+
+void Listener::accept()
+{
+    while (true) {
+        int fd = accept4(unix_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (!addFd(fd)) {
+            ::close(fd);
+            continue;
+        }
+        int source = next_source++;
+        connections.emplace(fd, std::make_unique<Connection>(Connection{source, InputReader{fd}}));
+        std::cerr << "[XViewMap] source " << source << " connected" << std::endl;
+    }
+}
+
+void Listener::receive()
+{
+    // 1回のrecvmmsgで溜まっている分をまとめて受け取る
+    mmsghdr msgs[udp_batch] = {};
+    iovec iovs[udp_batch];
+    sockaddr_in addrs[udp_batch];
+    for (std::size_t i = 0; i < udp_batch; i++) {
+        iovs[i] = {udp_buf.data() + i * udp_size, udp_size};
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    }
+    datagrams.clear();
+    int n = recvmmsg(udp_fd, msgs, udp_batch, MSG_DONTWAIT, nullptr);
+    for (int i = 0; i < n; i++) {
+        auto key = std::make_pair(addrs[i].sin_addr.s_addr, addrs[i].sin_port);
+        auto [it, inserted] = udp_sources.emplace(key, next_source);
+        if (inserted) {
+            next_source++;
+            std::cerr << "[XViewMap] source " << it->second << " from UDP port "
+                      << ntohs(addrs[i].sin_port) << std::endl;
+        }
+        datagrams.push_back({it->second, msgs[i].msg_len});
+    }
+}
+
+void Listener::close(int fd)
+{
+    auto it = connections.find(fd);
+    if (it == connections.end()) {
+        return;
+    }
+    std::cerr << "[XViewMap] source " << it->second->source << " disconnected" << std::endl;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    connections.erase(it);
+}
+#else
+bool Listener::addFd(int) { return false; }
+bool Listener::listenUnix(const std::string&)
+{
+    std::cerr << "[XViewMap] Listening on sockets is only supported on Linux" << std::endl;
+    return false;
+}
+bool Listener::listenUdp(int)
+{
+    std::cerr << "[XViewMap] Listening on sockets is only supported on Linux" << std::endl;
+    return false;
+}
+void Listener::wait() { ready.clear(); }
+void Listener::accept() {}
+void Listener::receive() { datagrams.clear(); }
+void Listener::close(int fd)
+{
+    ::close(fd);
+    connections.erase(fd);
+}
+#endif
+}  // namespace XViewMap
@@ -0,0 +1,91 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "input.hpp"
+
+namespace XViewMap
+{
+// Unix-domainソケット(ストリーム)とlocalhostのUDPで、複数のプロセスから行・レコードを受け取る
+// 送ってきた相手ごとにsource(1から)を振り、行・レコードと一緒に渡す
+// Linuxではepollで待つ(それ以外では使えない)
+class Listener
+{
+    int epoll_fd = -1;
+    int unix_fd = -1, udp_fd = -1;
+    std::string unix_path;
+    int next_source = 1;
+
+    struct Connection {
+        int source;
+        InputReader reader;
+    };
+    std::map<int /* fd */, std::unique_ptr<Connection>> connections;
+    std::map<std::pair<std::uint32_t, std::uint16_t> /* アドレス、ポート */, int> udp_sources;
+
+    // 読めるようになったfd(wait()で集める)
+    std::vector<int> ready;
+    // 1回で受け取るデータグラム
+    static constexpr std::size_t udp_batch = 64, udp_size = 4096;
+    std::vector<char> udp_buf;
+    struct Datagram {
+        int source;
+        std::size_t size;
+    };
+    std::vector<Datagram> datagrams;
+
+    bool addFd(int fd);
+    void wait();
+    void accept();
+    void receive();
+    void close(int fd);
+
+public:
+    Listener() = default;
+    Listener(const Listener&) = delete;
+    Listener& operator=(const Listener&) = delete;
+    ~Listener();
+
+    bool listenUnix(const std::string& path);
+    // 127.0.0.1のportで受ける
+    bool listenUdp(int port);
+    // pollで待つfd(何もlistenしていなければ-1)
+    int fd() const { return epoll_fd; }
+
+    // 読めるものを全部読んで、on_line(source, std::string_view)とon_record(source, const char*)に渡す
+    // 接続が切れたsourceはon_close(source)に渡す(UDPは切れない)
+    // fd()が読めるようになってから呼ぶ(待たない)
+    template <typename F, typename G, typename H>
+    void process(F&& on_line, G&& on_record, H&& on_close)
+    {
+        wait();
+        for (int fd : ready) {
+            if (fd == unix_fd) {
+                accept();
+            } else if (fd == udp_fd) {
+                receive();
+                const char* data = udp_buf.data();
+                for (const Datagram& d : datagrams) {
+                    InputReader::splitAll(
+                        data, d.size, [&](std::string_view line) { on_line(d.source, line); },
+                        [&](const char* record) { on_record(d.source, record); });
+                    data += udp_size;
+                }
+            } else if (auto it = connections.find(fd); it != connections.end()) {
+                Connection& c = *it->second;
+                bool open = c.reader.read([&](std::string_view line) { on_line(c.source, line); },
+                    [&](const char* record) { on_record(c.source, record); });
+                if (!open) {
+                    int source = c.source;
+                    close(fd);
+                    on_close(source);
+                }
+            }
+        }
+    }
+};
+}  // namespace XViewMap
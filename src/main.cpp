@@ -1,54 +1,144 @@
 #include <xviewmap.hpp>
-#include <string>
-#include <sstream>
-#include <vector>
-#include <stdexcept>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <poll.h>
+#include <string_view>
+#include "input.hpp"
+#include "listener.hpp"
+#include "shm_ring.hpp"
 
 int main(int argc, char const* argv[])
 {
+    // xviewmap [--shm NAME] [--unix PATH] [--udp PORT] [--source N] [tomlファイル]
+    const char* toml_path = nullptr;
+    const char* shm_name = nullptr;
+    const char* unix_path = nullptr;
+    int udp_port = 0;
+    int robot_source = -1;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            shm_name = argv[++i];
+        } else if (std::strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            unix_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--udp") == 0 && i + 1 < argc) {
+            udp_port = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--source") == 0 && i + 1 < argc) {
+            robot_source = std::atoi(argv[++i]);
+        } else {
+            toml_path = argv[i];
+        }
+    }
+
     XViewMap::ViewMap viewmap{};
 
-    if (argc >= 2) {
-        viewmap.readToml(argv[1]);
+    if (toml_path) {
+        viewmap.readToml(toml_path);
     } else {
         viewmap.readToml();
     }
 
-    while (!std::cin.eof()) {
-        std::string inl;
-        std::getline(std::cin, inl);
-        std::vector<std::string> in_data;
-        std::istringstream ins(inl);
-        while (!ins.eof()) {
-            std::string ds;
-            std::getline(ins, ds, ' ');
-            if (!ds.empty()) {
-                in_data.push_back(ds);
+    XViewMap::ShmRingReader ring;
+    if (shm_name && !ring.create(shm_name)) {
+        return 1;
+    }
+    XViewMap::Listener listener;
+    if ((unix_path && !listener.listenUnix(unix_path))
+        || (udp_port > 0 && !listener.listenUdp(udp_port))) {
+        return 1;
+    }
+
+    XViewMap::InputReader reader{STDIN_FILENO};
+    std::size_t malformed_lines = 0;
+    // ロボットは1台しか描けないので、1つのsource(stdinと共有メモリは0)の位置だけを表示する
+    // --sourceで指定しなければ最初に位置を送ってきたsourceにし、そのsourceが切れたら次に送ってきたものにする
+    // 他のsourceの位置は数えて捨てる
+    bool robot_source_fixed = robot_source >= 0;
+    std::map<int, std::size_t> ignored_samples;
+    auto apply = [&](int source, const XViewMap::InputLine& in) {
+        if (in.type == XViewMap::InputLine::Type::FieldMap
+            || in.type == XViewMap::InputLine::Type::LocusMap) {
+            if (robot_source < 0) {
+                robot_source = source;
+                std::cerr << "[XViewMap] Showing the robot from source " << source << std::endl;
+            }
+            if (source != robot_source) {
+                if (ignored_samples[source]++ == 0) {
+                    std::cerr << "[XViewMap] Ignoring positions from source " << source
+                              << " (showing source " << robot_source << ")" << std::endl;
+                }
+                return;
             }
         }
-        if (in_data.size() >= 8 && in_data[1] == "[FieldMap]") {
-            try {
-                double x = std::stod(in_data[2]);
-                double y = std::stod(in_data[3]);
-                double th = std::stod(in_data[4]);
-                double vx = std::stod(in_data[5]);
-                double vy = std::stod(in_data[6]);
-                double vth = std::stod(in_data[7]);
-                viewmap.updatePos(x, y, th, vx, vy, vth);
-            } catch (const std::invalid_argument&) {
+        switch (in.type) {
+        case XViewMap::InputLine::Type::FieldMap:
+            viewmap.updatePos(in.pos, in.vel);
+            break;
+        case XViewMap::InputLine::Type::LocusMap:
+            viewmap.updateLocus(in.pos);
+            break;
+        case XViewMap::InputLine::Type::Malformed:
+            malformed_lines++;
+            break;
+        case XViewMap::InputLine::Type::Other:
+            break;  // そのまま出力するのは行のときだけ
+        }
+    };
+    auto onLine = [&](std::string_view inl) {
+        auto in = XViewMap::parseInputLine(inl);
+        if (in.type == XViewMap::InputLine::Type::Other) {
+            std::cout.write(inl.data(), static_cast<std::streamsize>(inl.size())) << '\n';
+        }
+        apply(0, in);
+    };
+    auto onRecord = [&](const char* record) { apply(0, XViewMap::parseInputRecord(record)); };
+    // ソケットから来たものは、無関係な行をsourceを付けて出力する
+    auto onSourceLine = [&](int source, std::string_view inl) {
+        auto in = XViewMap::parseInputLine(inl);
+        if (in.type == XViewMap::InputLine::Type::Other) {
+            std::cout << "[source " << source << "] ";
+            std::cout.write(inl.data(), static_cast<std::streamsize>(inl.size())) << '\n';
+        }
+        apply(source, in);
+    };
+    auto onSourceRecord = [&](int source, const char* record) {
+        apply(source, XViewMap::parseInputRecord(record));
+    };
+    auto onSourceClose = [&](int source) {
+        if (!robot_source_fixed && source == robot_source) {
+            robot_source = -1;
+        }
+    };
+
+    // stdinとソケットをpollで待つ
+    // 共有メモリに書く側は何も知らせてこないので、そのときは一定間隔で見に行く
+    // 共有メモリかソケットを使うときは、stdinが閉じても読み続ける
+    bool serving = shm_name || listener.fd() >= 0;
+    int timeout = shm_name ? XViewMap::ShmRingReader::poll_interval_ms : -1;
+    bool stdin_open = true;
+    while (stdin_open || serving) {
+        pollfd pfds[2] = {
+            {stdin_open ? STDIN_FILENO : -1, POLLIN, 0}, {listener.fd(), POLLIN, 0}};
+        if (poll(pfds, 2, timeout) > 0) {
+            if (pfds[0].revents != 0) {
+                stdin_open = reader.read(onLine, onRecord);
             }
-        } else if (in_data.size() >= 5 && in_data[1] == "[LocusMap]") {
-            try {
-                double x = std::stod(in_data[2]);
-                double y = std::stod(in_data[3]);
-                double th = std::stod(in_data[4]);
-                viewmap.updateLocus(x, y, th);
-            } catch (const std::invalid_argument&) {
+            if (pfds[1].revents != 0) {
+                listener.process(onSourceLine, onSourceRecord, onSourceClose);
             }
-        } else {
-            std::cout << inl << std::endl;
+            std::cout.flush();
         }
+        ring.read(onRecord);
+    }
+    if (malformed_lines > 0) {
+        std::cerr << "[XViewMap] " << malformed_lines << " malformed lines/records ignored"
+                  << std::endl;
+    }
+    for (auto [source, n] : ignored_samples) {
+        std::cerr << "[XViewMap] " << n << " positions from source " << source << " ignored"
+                  << std::endl;
     }
 
     return 0;
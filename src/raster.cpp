@@ -0,0 +1,139 @@
+#include "raster.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+
+namespace XViewMap
+{
+bool clipSegment(double& x1, double& y1, double& x2, double& y2, double min, double max)
+{
+    double t0 = 0, t1 = 1;
+    double dx = x2 - x1, dy = y2 - y1;
+    for (auto [p, q] : {std::make_pair(-dx, x1 - min), std::make_pair(dx, max - x1),
+             std::make_pair(-dy, y1 - min), std::make_pair(dy, max - y1)}) {
+        if (p == 0) {
+            if (q < 0) {
+                return false;
+            }
+        } else if (p < 0) {
+            t0 = std::max(t0, q / p);
+        } else {
+            t1 = std::min(t1, q / p);
+        }
+    }
+    if (t0 > t1) {
+        return false;
+    }
+    double ox = x1, oy = y1;
+    x1 = ox + t0 * dx;
+    y1 = oy + t0 * dy;
+    x2 = ox + t1 * dx;
+    y2 = oy + t1 * dy;
+    return true;
+}
+
+template <typename Pixel>
+void BasicRasterImage<Pixel>::fill(Pixel color)
+{
+    std::fill(pixels.begin(), pixels.end(), color);
+}
+
+template <typename Pixel>
+void BasicRasterImage<Pixel>::fillRect(int x, int y, int width, int height, Pixel color)
+{
+    int x_begin = std::max(x, 0), x_end = std::min(x + width, this->width);
+    for (int dy = std::max(y, 0); dy < std::min(y + height, this->height); dy++) {
+        Pixel* row = pixels.data() + static_cast<std::size_t>(dy) * this->width;
+        std::fill(row + x_begin, row + std::max(x_end, x_begin), color);
+    }
+}
+
+template <typename Pixel>
+void BasicRasterImage<Pixel>::fillMasked(const MaskImage& mask, int src_x, int src_y, int width,
+    int height, int x, int y, Pixel color)
+{
+    // maskからはみ出す部分も捨てる
+    if (src_x < 0) {
+        width += src_x;
+        x -= src_x;
+        src_x = 0;
+    }
+    if (src_y < 0) {
+        height += src_y;
+        y -= src_y;
+        src_y = 0;
+    }
+    width = std::min(width, mask.width - src_x);
+    height = std::min(height, mask.height - src_y);
+    int x_begin = std::max(x, 0), x_end = std::min(x + width, this->width);
+    for (int dy = std::max(y, 0); dy < std::min(y + height, this->height); dy++) {
+        const std::uint8_t* from = mask.pixels.data()
+                                   + static_cast<std::size_t>(src_y + dy - y) * mask.width
+                                   + (src_x - x);
+        Pixel* to = pixels.data() + static_cast<std::size_t>(dy) * this->width;
+        for (int dx = x_begin; dx < x_end; dx++) {
+            if (from[dx]) {
+                to[dx] = color;
+            }
+        }
+    }
+}
+
+template <typename Pixel>
+void BasicRasterImage<Pixel>::drawLine(double x1, double y1, double x2, double y2, Pixel color)
+{
+    // 太さの分だけ外側まで残す
+    if (!clipSegment(x1, y1, x2, y2, -2, std::max(width, height) + 2)) {
+        return;
+    }
+    int ix1 = static_cast<int>(std::lround(x1)), iy1 = static_cast<int>(std::lround(y1));
+    int ix2 = static_cast<int>(std::lround(x2)), iy2 = static_cast<int>(std::lround(y2));
+    // Bresenham、長い方向と直交する向きに1px足して幅2にする
+    int dx = std::abs(ix2 - ix1), dy = std::abs(iy2 - iy1);
+    int sx = ix1 < ix2 ? 1 : -1, sy = iy1 < iy2 ? 1 : -1;
+    bool x_major = dx >= dy;
+    int err = (x_major ? dx : dy) / 2;
+    int x = ix1, y = iy1;
+    for (int i = 0, n = std::max(dx, dy); i <= n; i++) {
+        plot(x, y, color);
+        if (x_major) {
+            plot(x, y - 1, color);
+            x += sx;
+            err -= dy;
+            if (err < 0) {
+                y += sy;
+                err += dx;
+            }
+        } else {
+            plot(x - 1, y, color);
+            y += sy;
+            err -= dx;
+            if (err < 0) {
+                x += sx;
+                err += dy;
+            }
+        }
+    }
+}
+
+template <typename Pixel>
+void BasicRasterImage<Pixel>::drawArc(
+    double cx, double cy, double r, double a1, double a2, Pixel color)
+{
+    // 2pxくらいずつの折れ線で近似
+    int n = std::clamp(static_cast<int>(r * std::abs(a2 - a1) * M_PI / 180 / 2), 8, 4096);
+    double px = cx + r * std::cos(a1 * M_PI / 180), py = cy - r * std::sin(a1 * M_PI / 180);
+    for (int k = 1; k <= n; k++) {
+        double t = (a1 + (a2 - a1) * k / n) * M_PI / 180;
+        double x = cx + r * std::cos(t), y = cy - r * std::sin(t);
+        drawLine(px, py, x, y, color);
+        px = x;
+        py = y;
+    }
+}
+
+// 画面とマスクの分だけ
+template class BasicRasterImage<std::uint32_t>;
+template class BasicRasterImage<std::uint8_t>;
+}  // namespace XViewMap
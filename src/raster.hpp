@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace XViewMap
+{
+// 線分を[min, max]四方に切り取る(Liang-Barsky)
+// 全部外ならfalse
+bool clipSegment(double& x1, double& y1, double& x2, double& y2, double min, double max);
+
+// Xサーバーを使わずにメモリ上に描く画像
+// 画面(RasterImage)はbackendのpaletteの色、マスク(MaskImage)は0か1を画素に持つ
+// 線はXのGCに合わせて幅2px
+template <typename Pixel>
+class BasicRasterImage
+{
+    int width, height;
+    std::vector<Pixel> pixels;
+
+    void plot(int x, int y, Pixel color)
+    {
+        if (x >= 0 && x < width && y >= 0 && y < height) {
+            pixels[static_cast<std::size_t>(y) * width + x] = color;
+        }
+    }
+
+public:
+    BasicRasterImage(int width, int height)
+        : width(width), height(height), pixels(static_cast<std::size_t>(width) * height)
+    {
+    }
+    BasicRasterImage(const BasicRasterImage&) = delete;
+    BasicRasterImage& operator=(const BasicRasterImage&) = delete;
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    Pixel* data() { return pixels.data(); }
+    const Pixel* data() const { return pixels.data(); }
+
+    void fill(Pixel color);
+    // はみ出した部分は捨てる
+    void fillRect(int x, int y, int width, int height, Pixel color);
+    // maskの(src_x, src_y)からwidth*heightの部分のうち0でないところを、左上が(x, y)になるようにcolorで塗る
+    // はみ出した部分は捨てる
+    void fillMasked(const BasicRasterImage<std::uint8_t>& mask, int src_x, int src_y, int width,
+        int height, int x, int y, Pixel color);
+    // 範囲外の部分は切り取る
+    void drawLine(double x1, double y1, double x2, double y2, Pixel color);
+    // (cx, cy)中心、半径rの円弧を角度a1〜a2(度、0が右、反時計回り)の範囲で描く
+    void drawArc(double cx, double cy, double r, double a1, double a2, Pixel color);
+
+    template <typename>
+    friend class BasicRasterImage;
+};
+using RasterImage = BasicRasterImage<std::uint32_t>;
+using MaskImage = BasicRasterImage<std::uint8_t>;
+}  // namespace XViewMap
@@ -0,0 +1,200 @@
+#include "remote.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include "input.hpp"
+
+namespace XViewMap
+{
+namespace
+{
+#ifdef MSG_NOSIGNAL
+constexpr int send_flags = MSG_NOSIGNAL;
+#else
+constexpr int send_flags = 0;  // SO_NOSIGPIPEを使う
+#endif
+
+// 子プロセスで、親から受け取ったものを描く
+// 親がソケットを閉じたら(ViewMapを消すか、親のプロセスが終わったら)終わる
+// (PR_SET_PDEATHSIGはforkしたスレッドが終わったときに来てしまうので使わない)
+[[noreturn]] void runViewer(const ViewMapOptions& options, int sock, ShmRingReader& ring)
+{
+#ifdef __linux__
+    // forkしたスレッドのSCHED_FIFOやCPUの割り当てを引き継いでいるので、普通のスレッドに戻す
+    // (描画が制御のスレッドと同じ優先度・CPUで競合しないように)
+    sched_param param = {};
+    if (sched_setscheduler(0, SCHED_OTHER, &param) != 0) {
+        std::cerr << "[XViewMap] Failed to reset the viewer scheduling policy: "
+                  << std::strerror(errno) << std::endl;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+        CPU_SET(i, &cpus);
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        std::cerr << "[XViewMap] Failed to reset the viewer CPU affinity: "
+                  << std::strerror(errno) << std::endl;
+    }
+#endif
+    {
+        ViewMapOptions viewer_options = options;
+        viewer_options.out_of_process = false;
+        ViewMap viewer(viewer_options);
+        std::vector<Pos> wheels, machine;
+        double wheel_radius = 0;
+        auto apply = [&](const char* record) {
+            InputRecord r = decodeInputRecord(record);
+            const auto& v = r.values;
+            switch (r.kind) {
+            case XVIEWMAP_RECORD_FIELDMAP:
+                viewer.updatePos({v[0], v[1], v[2]}, {v[3], v[4], v[5]});
+                break;
+            case XVIEWMAP_RECORD_LOCUSMAP:
+                viewer.updateLocus({v[0], v[1], v[2]});
+                break;
+            case remote_reset_pos:
+                viewer.resetPos({v[0], v[1], v[2]});
+                break;
+            case remote_reset_locus:
+                viewer.resetLocus({v[0], v[1], v[2]});
+                break;
+            case remote_field_range:
+                viewer.setField(v[0], v[1], v[2], v[3]);
+                break;
+            case remote_field_line:
+                viewer.drawFieldLine(v[0], v[1], v[2], v[3]);
+                break;
+            case remote_field_arc:
+                viewer.drawFieldArc(v[0], v[1], v[2], v[3], v[4]);
+                break;
+            case remote_frame_rate:
+                viewer.setFrameRate(v[0]);
+                break;
+            case remote_layer_visible:
+                viewer.setLayerVisible(static_cast<Layer>(static_cast<int>(v[0])), v[1] != 0);
+                break;
+            case remote_robot_begin:
+                wheels.clear();
+                machine.clear();
+                wheel_radius = v[0];
+                break;
+            case remote_robot_wheel:
+                wheels.push_back({v[0], v[1], v[2]});
+                break;
+            case remote_robot_machine:
+                machine.push_back({v[0], v[1], v[2]});
+                break;
+            case remote_robot_end:
+                viewer.setRobot(wheels, wheel_radius, machine);
+                break;
+            }
+        };
+        // 位置はリングに書かれるだけなので、ソケットを待ちつつ一定間隔で見に行く
+        InputReader reader{sock};
+        while (true) {
+            pollfd pfd = {sock, POLLIN, 0};
+            if (poll(&pfd, 1, ShmRingReader::poll_interval_ms) > 0 && pfd.revents != 0
+                && !reader.read([](std::string_view) {}, apply)) {
+                break;
+            }
+            ring.read(apply);
+        }
+    }
+    // 親から引き継いだものは片付けずに終わる
+    _exit(0);
+}
+}  // namespace
+
+std::unique_ptr<ViewMap::Remote> ViewMap::Remote::start(const ViewMapOptions& options)
+{
+    auto remote = std::make_unique<Remote>();
+    if (!remote->ring.createAnonymous(static_cast<std::uint32_t>(options.queue_capacity))) {
+        return nullptr;
+    }
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        std::cerr << "[XViewMap] socketpair failed: " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    // 後で親がexecした他のプロセスにソケットが残ると、親が終わっても子が終わらない
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "[XViewMap] fork failed: " << std::strerror(errno) << std::endl;
+        close(fds[0]);
+        close(fds[1]);
+        return nullptr;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        runViewer(options, fds[1], remote->ring);
+    }
+    close(fds[1]);
+    remote->pid = pid;
+    remote->sock = fds[0];
+    // 子が止まっていても、設定を送るところで待ち続けないように
+    timeval timeout = {1, 0};
+    setsockopt(remote->sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(remote->sock, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    return remote;
+}
+
+ViewMap::Remote::~Remote()
+{
+    if (sock >= 0) {
+        close(sock);
+    }
+    if (pid <= 0) {
+        return;
+    }
+    // 1秒待っても終わらなければ止める
+    for (int i = 0; i < 100; i++) {
+        if (waitpid(pid, nullptr, WNOHANG) != 0) {
+            return;
+        }
+        usleep(10000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+}
+
+void ViewMap::Remote::send(
+    std::uint16_t kind, double v0, double v1, double v2, double v3, double v4, double v5)
+{
+    if (!alive) {
+        return;
+    }
+    unsigned char rec[XVIEWMAP_RECORD_SIZE];
+    xviewmap_record(rec, kind, 0, 0, v0, v1, v2, v3, v4, v5);
+    std::size_t sent = 0;
+    while (sent < sizeof(rec)) {
+        ssize_t n = ::send(sock, rec + sent, sizeof(rec) - sent, send_flags);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // 子が落ちたか止まっている、位置はリングに書き続ける
+            std::cerr << "[XViewMap] Viewer process is not responding" << std::endl;
+            alive = false;
+            return;
+        }
+        sent += static_cast<std::size_t>(n);
+    }
+}
+}  // namespace XViewMap
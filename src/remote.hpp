@@ -0,0 +1,46 @@
+#pragma once
+#include <xviewmap.hpp>
+#include <cstdint>
+#include <memory>
+#include <xviewmap_record.h>
+#include "shm_ring.hpp"
+
+namespace XViewMap
+{
+// 子プロセスに送るレコードのkind(xviewmap_record.hのFIELDMAP/LOCUSMAPの続き)
+constexpr std::uint16_t remote_reset_pos = 3, remote_reset_locus = 4;
+constexpr std::uint16_t remote_field_range = 5, remote_field_line = 6, remote_field_arc = 7;
+constexpr std::uint16_t remote_frame_rate = 8, remote_layer_visible = 9;
+// robot_beginのあとwheel, machineを1個ずつ送り、robot_endでsetRobotする
+constexpr std::uint16_t remote_robot_begin = 10, remote_robot_wheel = 11,
+                        remote_robot_machine = 12, remote_robot_end = 13;
+
+// out_of_processのときの、描画する子プロセスとの接続
+// ロボットの位置・軌跡は共有メモリのリングに書く(システムコール・待ち無し)
+// フィールドなどの設定はソケットで送る(子が応答しなければ諦める)
+struct ViewMap::Remote {
+    int pid = -1;
+    int sock = -1;
+    bool alive = true;  // 設定を送れているか
+    ShmRingReader ring;
+
+    Remote() = default;
+    Remote(const Remote&) = delete;
+    Remote& operator=(const Remote&) = delete;
+    // ソケットを閉じると子は終わる(終わらなければ止める)
+    ~Remote();
+
+    // 子プロセスを起動する、失敗したらnullptr
+    static std::unique_ptr<Remote> start(const ViewMapOptions& options);
+
+    void push(std::uint16_t kind, double v0 = 0, double v1 = 0, double v2 = 0, double v3 = 0,
+        double v4 = 0, double v5 = 0)
+    {
+        unsigned char rec[XVIEWMAP_RECORD_SIZE];
+        xviewmap_record(rec, kind, 0, 0, v0, v1, v2, v3, v4, v5);
+        xviewmap_shm_write(ring.ring(), rec);
+    }
+    void send(std::uint16_t kind, double v0 = 0, double v1 = 0, double v2 = 0, double v3 = 0,
+        double v4 = 0, double v5 = 0);
+};
+}  // namespace XViewMap
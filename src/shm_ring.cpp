@@ -0,0 +1,105 @@
+#include "shm_ring.hpp"
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace XViewMap
+{
+namespace
+{
+std::uint32_t roundUpPow2(std::uint32_t n)
+{
+    std::uint32_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+}  // namespace
+
+ShmRingReader::~ShmRingReader()
+{
+    if (shm) {
+        munmap(shm, mapped_size);
+    }
+}
+
+bool ShmRingReader::create(std::string name, std::uint32_t capacity)
+{
+    if (name.empty() || name.front() != '/') {
+        name = "/" + name;
+    }
+    std::uint32_t cap = roundUpPow2(capacity);
+    std::size_t size = xviewmap_shm_size(cap);
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        std::cerr << "[XViewMap] Failed to open shared memory " << name << std::endl;
+        return false;
+    }
+    struct stat st = {};
+    if (fstat(fd, &st) == 0 && st.st_size != 0 && static_cast<std::size_t>(st.st_size) != size) {
+        // 大きさの違うものを書き換えると、開いたままの書く側がはみ出して書くので作り直す
+        close(fd);
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            std::cerr << "[XViewMap] Failed to open shared memory " << name << std::endl;
+            return false;
+        }
+        st.st_size = 0;
+    }
+    bool reuse = static_cast<std::size_t>(st.st_size) == size;
+    if (!reuse && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        std::cerr << "[XViewMap] Failed to resize shared memory " << name << std::endl;
+        close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "[XViewMap] Failed to map shared memory " << name << std::endl;
+        return false;
+    }
+    shm = static_cast<xviewmap_shm*>(p);
+    mapped_size = size;
+    if (reuse && __atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) == XVIEWMAP_SHM_MAGIC
+        && shm->capacity == cap) {
+        // 前のxviewmapが作ったもの、古いレコードは読まない
+        read_index = __atomic_load_n(&shm->write_index, __ATOMIC_ACQUIRE);
+        return true;
+    }
+    init(cap);
+    return true;
+}
+
+bool ShmRingReader::createAnonymous(std::uint32_t capacity)
+{
+    std::uint32_t cap = roundUpPow2(capacity);
+    std::size_t size = xviewmap_shm_size(cap);
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        std::cerr << "[XViewMap] Failed to map shared memory" << std::endl;
+        return false;
+    }
+    shm = static_cast<xviewmap_shm*>(p);
+    mapped_size = size;
+    init(cap);
+    return true;
+}
+
+void ShmRingReader::init(std::uint32_t cap)
+{
+    // 初期化してから、書く側に見せる
+    __atomic_store_n(&shm->magic, 0, __ATOMIC_RELAXED);
+    shm->capacity = cap;
+    __atomic_store_n(&shm->write_index, 0, __ATOMIC_RELAXED);
+    xviewmap_shm_slot* slots = xviewmap_shm_slots(shm);
+    for (std::uint32_t i = 0; i < cap; i++) {
+        __atomic_store_n(&slots[i].seq, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&shm->magic, XVIEWMAP_SHM_MAGIC, __ATOMIC_RELEASE);
+    read_index = 0;
+}
+}  // namespace XViewMap
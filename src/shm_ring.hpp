@@ -0,0 +1,89 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <xviewmap_shm.h>
+
+namespace XViewMap
+{
+// xviewmap_shm.hのリングを作って、書かれたレコードを読む側
+// 書く側はシステムコールをしないので、読む側が自分のタイミングでread()する
+class ShmRingReader
+{
+    xviewmap_shm* shm = nullptr;
+    std::size_t mapped_size = 0;
+    std::uint64_t read_index = 0;
+    std::size_t num_dropped = 0;
+    // readで渡すレコード(slotのを写したもの)
+    alignas(8) unsigned char record[XVIEWMAP_RECORD_SIZE];
+
+    void init(std::uint32_t capacity);
+
+public:
+    static constexpr std::uint32_t default_capacity = 1 << 16;
+    // 読む側が見に行く間隔(この間にcapacityより多く書かれると古いものから捨てる)
+    static constexpr int poll_interval_ms = 5;
+
+    ShmRingReader() = default;
+    ShmRingReader(const ShmRingReader&) = delete;
+    ShmRingReader& operator=(const ShmRingReader&) = delete;
+    ~ShmRingReader();
+
+    // nameの共有メモリを作る(先頭の/は省略可)
+    // 同じ形のものが既にあれば、書く側が開いたままでも続けて使えるようにそのまま使う
+    // 終了しても消さない(書く側が開き直さずに済むように)
+    bool create(std::string name, std::uint32_t capacity = default_capacity);
+    // 名前の無い共有メモリを作る(forkした子プロセスとの間で使う)
+    bool createAnonymous(std::uint32_t capacity = default_capacity);
+    // 書く側が使うリング
+    xviewmap_shm* ring() const { return shm; }
+
+    // 書き終わっているレコードを順にf(const char*)に渡し、渡した数を返す
+    // 書く側に追い越されたものは捨てる
+    // 書き込み途中のslotがあればそこで止まる(書く側が途中で死んだ場合は、一周されると先に進む)
+    template <typename F>
+    std::size_t read(F&& f)
+    {
+        if (!shm) {
+            return 0;
+        }
+        std::uint64_t capacity = shm->capacity;
+        xviewmap_shm_slot* slots = xviewmap_shm_slots(shm);
+        std::size_t n = 0;
+        while (true) {
+            std::uint64_t w = __atomic_load_n(&shm->write_index, __ATOMIC_ACQUIRE);
+            if (read_index >= w) {
+                break;
+            }
+            if (w - read_index > capacity) {
+                num_dropped += w - capacity - read_index;
+                read_index = w - capacity;
+            }
+            xviewmap_shm_slot& slot = slots[read_index & (capacity - 1)];
+            std::uint64_t s = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+            if (s < 2 * read_index + 2) {
+                break;
+            }
+            if (s == 2 * read_index + 2) {
+                for (std::size_t k = 0; k < XVIEWMAP_RECORD_SIZE / 8; k++) {
+                    std::uint64_t word = __atomic_load_n(&slot.record[k], __ATOMIC_RELAXED);
+                    __builtin_memcpy(record + k * 8, &word, sizeof(word));
+                }
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&slot.seq, __ATOMIC_RELAXED) == s) {
+                    read_index++;
+                    n++;
+                    f(reinterpret_cast<const char*>(record));
+                    continue;
+                }
+            }
+            // 読んでいる間に追い越された
+            read_index++;
+            num_dropped++;
+        }
+        return n;
+    }
+    // 追い越されて読めなかった数
+    std::size_t dropped() const { return num_dropped; }
+};
+}  // namespace XViewMap
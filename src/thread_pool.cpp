@@ -0,0 +1,105 @@
+#include "thread_pool.hpp"
+#include <algorithm>
+
+namespace XViewMap
+{
+ThreadPool::ThreadPool(std::size_t threads)
+{
+    for (std::size_t i = 0; i < threads + 1; i++) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (std::size_t i = 0; i < threads; i++) {
+        workers.emplace_back([this, i]() { workerThread(i); });
+    }
+}
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(mtx);
+        stopped = true;
+    }
+    start_cv.notify_all();
+    for (auto& t : workers) {
+        t.join();
+    }
+}
+
+// 自分のキューの後ろから取り、無ければ他のキューの前から盗む
+bool ThreadPool::take(std::size_t self, std::size_t& task)
+{
+    {
+        Queue& q = *queues[self];
+        std::lock_guard lock(q.mtx);
+        if (!q.tasks.empty()) {
+            task = q.tasks.back();
+            q.tasks.pop_back();
+            return true;
+        }
+    }
+    for (std::size_t k = 1; k < queues.size(); k++) {
+        Queue& q = *queues[(self + k) % queues.size()];
+        std::lock_guard lock(q.mtx);
+        if (!q.tasks.empty()) {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+void ThreadPool::work(std::size_t self, const std::function<void(std::size_t)>& f)
+{
+    std::size_t task;
+    while (take(self, task)) {
+        f(task);
+    }
+}
+void ThreadPool::workerThread(std::size_t self)
+{
+    std::uint64_t last_job = 0;
+    while (true) {
+        const std::function<void(std::size_t)>* f;
+        {
+            std::unique_lock lock(mtx);
+            start_cv.wait(lock, [&] { return stopped || job_id != last_job; });
+            if (stopped) {
+                return;
+            }
+            last_job = job_id;
+            f = job;
+        }
+        work(self, *f);
+        {
+            std::lock_guard lock(mtx);
+            finished++;
+        }
+        done_cv.notify_one();
+    }
+}
+
+void ThreadPool::parallelFor(std::size_t n, const std::function<void(std::size_t)>& f)
+{
+    if (n == 0) {
+        return;
+    }
+    // 連続した番号はだいたい近い場所なので、まとめて同じキューに配る
+    std::size_t per_queue = (n + queues.size() - 1) / queues.size();
+    for (std::size_t i = 0; i < queues.size(); i++) {
+        std::lock_guard lock(queues[i]->mtx);
+        for (std::size_t task = i * per_queue; task < std::min(n, (i + 1) * per_queue); task++) {
+            queues[i]->tasks.push_back(task);
+        }
+    }
+    {
+        std::lock_guard lock(mtx);
+        job = &f;
+        job_id++;
+        finished = 0;
+    }
+    start_cv.notify_all();
+    work(queues.size() - 1, f);
+    // 自分が終わった時点でキューは空なので、workerが全員戻れば全部終わっている
+    std::unique_lock lock(mtx);
+    done_cv.wait(lock, [&] { return finished == workers.size(); });
+}
+}  // namespace XViewMap
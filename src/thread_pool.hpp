@@ -0,0 +1,52 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace XViewMap
+{
+// parallelForの仕事を分けて並列に実行するスレッドプール
+// 仕事は最初にスレッドごとのキューに配り、自分の分が無くなったスレッドは他のキューから盗む
+class ThreadPool
+{
+    struct Queue {
+        std::mutex mtx;
+        std::deque<std::size_t> tasks;
+    };
+    // workersの分と、parallelForを呼んだスレッドの分(最後)
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mtx;
+    std::condition_variable start_cv, done_cv;
+    const std::function<void(std::size_t)>* job = nullptr;
+    std::uint64_t job_id = 0;
+    // 今のjobを終えたworkerの数
+    // 全員が終えるまで次のjobを始めないので、古いjobのfで新しい仕事を実行することはない
+    std::size_t finished = 0;
+    bool stopped = false;
+
+    bool take(std::size_t self, std::size_t& task);
+    void work(std::size_t self, const std::function<void(std::size_t)>& f);
+    void workerThread(std::size_t self);
+
+public:
+    // threadsは呼び出し元以外に立てるスレッドの数
+    explicit ThreadPool(std::size_t threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // 呼び出し元も含めた並列数
+    std::size_t concurrency() const { return queues.size(); }
+    // f(0)〜f(n-1)を並列に実行し、全部終わるまで待つ
+    // 1つのスレッドからしか呼ばない
+    void parallelFor(std::size_t n, const std::function<void(std::size_t)>& f);
+};
+}  // namespace XViewMap
@@ -51,41 +51,44 @@ void applyTomlConfig(toml::table& config, XViewMap::ViewMap& visualizer)
             }
         }
     }
+    std::vector<Pos> machine_v = visualizer.getMachine();
+    std::vector<Pos> wheels_v = visualizer.getWheels();
+    double wheel_radius_v = visualizer.getWheelRadius();
     if (auto machine = config["robot"]["machine"]) {
-        visualizer.machine.clear();
+        machine_v.clear();
         for (std::size_t i = 0; i < machine.as_array()->size(); i++) {
             auto v = machine[i];
             auto x = v[0].value<double>();
             auto y = v[1].value<double>();
             if (x && y) {
-                visualizer.machine.push_back({*x, *y, 0});
+                machine_v.push_back({*x, *y, 0});
             } else {
                 std::cerr << "[XViewMap] invalid data in robot.machine" << std::endl;
             }
         }
     }
     if (auto wheel = config["robot"]["wheel"]) {
-        visualizer.wheels.clear();
+        wheels_v.clear();
         for (std::size_t i = 0; i < wheel.as_array()->size(); i++) {
             auto v = wheel[i];
             auto x = v[0].value<double>();
             auto y = v[1].value<double>();
             auto th = v[2].value<double>();
             if (x && y && th) {
-                visualizer.wheels.push_back({*x, *y, *th * 3.14 / 180});
+                wheels_v.push_back({*x, *y, *th * 3.14 / 180});
             } else {
                 std::cerr << "[XViewMap] invalid data in robot.wheel" << std::endl;
             }
         }
     }
     if (auto wheel_radius = config["robot"]["wheel_radius"]) {
-        auto wheel_radius_v = wheel_radius.value<double>();
-        if (wheel_radius_v) {
-            visualizer.wheel_radius = *wheel_radius_v;
+        if (auto r = wheel_radius.value<double>()) {
+            wheel_radius_v = *r;
         } else {
             std::cerr << "[XViewMap] invalid data in robot.wheel_radius" << std::endl;
         }
     }
+    visualizer.setRobot(wheels_v, wheel_radius_v, machine_v);
 }
 
 void ViewMap::readToml(const std::string& path)
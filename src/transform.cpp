@@ -0,0 +1,134 @@
+#include "transform.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define XVIEWMAP_X86_64
+#endif
+
+namespace XViewMap
+{
+namespace
+{
+// 一度に変換する点の数(スタックに置く)
+constexpr std::size_t block_size = 256;
+
+// 点を変換してpx,pyに入れ、範囲外の点はoutに1を入れる
+// 丸めはどれも最近接偶数丸め
+void transformScalar(const double* x, const double* y, std::size_t n, const FieldTransform& t,
+    double limit, std::int32_t* px, std::int32_t* py, std::uint8_t* out)
+{
+    for (std::size_t i = 0; i < n; i++) {
+        double wx = t.ofs_x + (t.max_y - y[i]) * t.zoom;
+        double wy = t.ofs_y + (t.max_x - x[i]) * t.zoom;
+        // NaNも範囲外
+        bool inside = wx >= -limit && wx <= limit && wy >= -limit && wy <= limit;
+        out[i] = !inside;
+        px[i] = inside ? static_cast<std::int32_t>(std::nearbyint(wx)) : 0;
+        py[i] = inside ? static_cast<std::int32_t>(std::nearbyint(wy)) : 0;
+    }
+}
+
+#ifdef XVIEWMAP_X86_64
+// x86_64ならSSE2は必ずある
+void transformSse2(const double* x, const double* y, std::size_t n, const FieldTransform& t,
+    double limit, std::int32_t* px, std::int32_t* py, std::uint8_t* out)
+{
+    const __m128d max_x = _mm_set1_pd(t.max_x), max_y = _mm_set1_pd(t.max_y);
+    const __m128d zoom = _mm_set1_pd(t.zoom);
+    const __m128d ofs_x = _mm_set1_pd(t.ofs_x), ofs_y = _mm_set1_pd(t.ofs_y);
+    const __m128d lo = _mm_set1_pd(-limit), hi = _mm_set1_pd(limit);
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d wx = _mm_add_pd(ofs_x, _mm_mul_pd(_mm_sub_pd(max_y, _mm_loadu_pd(y + i)), zoom));
+        __m128d wy = _mm_add_pd(ofs_y, _mm_mul_pd(_mm_sub_pd(max_x, _mm_loadu_pd(x + i)), zoom));
+        __m128d inside = _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(wx, lo), _mm_cmple_pd(wx, hi)),
+            _mm_and_pd(_mm_cmpge_pd(wy, lo), _mm_cmple_pd(wy, hi)));
+        int mask = _mm_movemask_pd(inside);
+        // 範囲外は0にしておく(cvtの結果が不定にならないように)
+        wx = _mm_and_pd(wx, inside);
+        wy = _mm_and_pd(wy, inside);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(px + i), _mm_cvtpd_epi32(wx));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(py + i), _mm_cvtpd_epi32(wy));
+        out[i] = !(mask & 1);
+        out[i + 1] = !(mask & 2);
+    }
+    transformScalar(x + i, y + i, n - i, t, limit, px + i, py + i, out + i);
+}
+
+#if defined(__GNUC__)
+__attribute__((target("avx2"))) void transformAvx2(const double* x, const double* y,
+    std::size_t n, const FieldTransform& t, double limit, std::int32_t* px, std::int32_t* py,
+    std::uint8_t* out)
+{
+    const __m256d max_x = _mm256_set1_pd(t.max_x), max_y = _mm256_set1_pd(t.max_y);
+    const __m256d zoom = _mm256_set1_pd(t.zoom);
+    const __m256d ofs_x = _mm256_set1_pd(t.ofs_x), ofs_y = _mm256_set1_pd(t.ofs_y);
+    const __m256d lo = _mm256_set1_pd(-limit), hi = _mm256_set1_pd(limit);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d wx = _mm256_add_pd(
+            ofs_x, _mm256_mul_pd(_mm256_sub_pd(max_y, _mm256_loadu_pd(y + i)), zoom));
+        __m256d wy = _mm256_add_pd(
+            ofs_y, _mm256_mul_pd(_mm256_sub_pd(max_x, _mm256_loadu_pd(x + i)), zoom));
+        __m256d inside = _mm256_and_pd(
+            _mm256_and_pd(_mm256_cmp_pd(wx, lo, _CMP_GE_OQ), _mm256_cmp_pd(wx, hi, _CMP_LE_OQ)),
+            _mm256_and_pd(_mm256_cmp_pd(wy, lo, _CMP_GE_OQ), _mm256_cmp_pd(wy, hi, _CMP_LE_OQ)));
+        int mask = _mm256_movemask_pd(inside);
+        wx = _mm256_and_pd(wx, inside);
+        wy = _mm256_and_pd(wy, inside);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(px + i), _mm256_cvtpd_epi32(wx));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(py + i), _mm256_cvtpd_epi32(wy));
+        for (int k = 0; k < 4; k++) {
+            out[i + k] = !(mask & (1 << k));
+        }
+    }
+    transformSse2(x + i, y + i, n - i, t, limit, px + i, py + i, out + i);
+}
+#endif
+#endif
+
+using TransformFunc = void (*)(const double*, const double*, std::size_t, const FieldTransform&,
+    double, std::int32_t*, std::int32_t*, std::uint8_t*);
+TransformFunc selectTransform()
+{
+#ifdef XVIEWMAP_X86_64
+#if defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) {
+        return transformAvx2;
+    }
+#endif
+    return transformSse2;
+#else
+    return transformScalar;
+#endif
+}
+}  // namespace
+
+std::size_t fieldToSegments(const double* x, const double* y, std::size_t n,
+    const FieldTransform& t, double limit, Segment16* out, std::uint8_t* outside)
+{
+    static const TransformFunc transform = selectTransform();
+    limit = std::min(limit, 32767.0);
+    std::size_t outside_num = 0;
+    std::array<std::int32_t, block_size> px, py;
+    std::array<std::uint8_t, block_size> out_point;
+    // ブロックの境目の線分のために、前のブロックの最後の点から始める
+    for (std::size_t begin = 0; begin + 1 < n; begin += block_size - 1) {
+        std::size_t count = std::min(block_size, n - begin);
+        transform(x + begin, y + begin, count, t, limit, px.data(), py.data(), out_point.data());
+        for (std::size_t k = 1; k < count; k++) {
+            Segment16& seg = out[begin + k - 1];
+            seg.x1 = static_cast<std::int16_t>(px[k - 1]);
+            seg.y1 = static_cast<std::int16_t>(py[k - 1]);
+            seg.x2 = static_cast<std::int16_t>(px[k]);
+            seg.y2 = static_cast<std::int16_t>(py[k]);
+            std::uint8_t o = out_point[k - 1] | out_point[k];
+            outside[begin + k - 1] = o;
+            outside_num += o;
+        }
+    }
+    return outside_num;
+}
+}  // namespace XViewMap
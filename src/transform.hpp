@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace XViewMap
+{
+// XSegmentと同じ並び
+struct Segment16 {
+    std::int16_t x1, y1, x2, y2;
+};
+
+// フィールド座標→画面座標
+//   画面x = ofs_x + (max_y - y) * zoom
+//   画面y = ofs_y + (max_x - x) * zoom
+struct FieldTransform {
+    double max_x, max_y, zoom, ofs_x, ofs_y;
+};
+
+// (x[i-1], y[i-1])と(x[i], y[i])を結ぶn-1本の線分を画面座標に変換してoutに入れる
+// 端点が[-limit, limit]に収まらない線分はshortに入らないのでoutside[i-1]を1にする(outの中身は不定)
+// 使えるならAVX2かSSE2でまとめて変換する
+// 戻り値はoutsideになった本数
+std::size_t fieldToSegments(const double* x, const double* y, std::size_t n,
+    const FieldTransform& t, double limit, Segment16* out, std::uint8_t* outside);
+}  // namespace XViewMap
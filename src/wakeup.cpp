@@ -0,0 +1,70 @@
+#include <wakeup.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+namespace XViewMap
+{
+Wakeup::Wakeup()
+{
+#ifdef __linux__
+    read_fd = write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    int fds[2];
+    if (pipe(fds) == 0) {
+        for (int fd : fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        read_fd = fds[0];
+        write_fd = fds[1];
+    }
+#endif
+}
+Wakeup::~Wakeup()
+{
+    if (read_fd >= 0) {
+        close(read_fd);
+    }
+    if (write_fd >= 0 && write_fd != read_fd) {
+        close(write_fd);
+    }
+}
+
+void Wakeup::prepare()
+{
+    waiting.store(true);
+    // notify側のfenceと対になる
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+void Wakeup::finish()
+{
+    waiting.store(false, std::memory_order_relaxed);
+}
+void Wakeup::drain()
+{
+    std::uint64_t buf;
+    while (read(read_fd, &buf, sizeof(buf)) > 0) {
+    }
+}
+
+void Wakeup::notify()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed) && waiting.exchange(false)) {
+        interrupt();
+    }
+}
+void Wakeup::interrupt()
+{
+    std::uint64_t one = 1;
+    ssize_t ret;
+    do {
+        ret = write(write_fd, &one, sizeof(one));
+    } while (ret < 0 && errno == EINTR);
+}
+}  // namespace XViewMap
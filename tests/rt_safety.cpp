@@ -0,0 +1,253 @@
+// updatePosRT/updateLocusRTがシステムコールもメモリ確保もしないこと、
+// それでも描画スレッドが反映することを確かめる(Linuxのみ)
+//
+// 場合ごとにforkした子プロセスで、ViewMapを作ってからスレッドを1つ立て、
+// そのスレッドだけにseccompのフィルタ(exit以外のシステムコールでSIGSYS)を掛けてRTの関数を呼ぶ
+// メモリ確保はmallocなどを差し替えて、そのスレッドの分だけ数える
+// 結果は共有メモリに書いて親プロセスが見る
+#include <xviewmap.hpp>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// 子プロセスから親へ
+struct Result {
+    std::atomic<long> syscall_nr;  // 呼ばれたシステムコール(無ければ-1)
+    std::atomic<long> allocations;
+    std::atomic<long> pos_pixels, locus_pixels;  // 描かれた軌跡(saveFrameできたときだけ)
+};
+Result* result;
+
+thread_local bool counting = false;
+std::atomic<bool> never = false;
+
+void onSigsys(int, siginfo_t* info, void*)
+{
+    result->syscall_nr.store(info->si_syscall);
+    // exit_groupはフィルタで通す
+    _exit(3);
+}
+
+// このスレッドでexit, exit_group, rt_sigreturn以外のシステムコールをするとSIGSYSにする
+bool forbidSyscalls()
+{
+    sock_filter filter[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, nr)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_exit_group, 3, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_exit, 2, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_rt_sigreturn, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRAP),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    };
+    sock_fprog prog = {static_cast<unsigned short>(sizeof(filter) / sizeof(filter[0])), filter};
+    return prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0
+           && prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == 0;
+}
+
+// PPM(P6)のうちrgbの画素の数
+long countPixels(const std::string& path, unsigned char r, unsigned char g, unsigned char b)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    std::string magic;
+    int width = 0, height = 0, max = 0;
+    ifs >> magic >> width >> height >> max;
+    ifs.get();
+    std::vector<unsigned char> data(static_cast<std::size_t>(width) * height * 3);
+    ifs.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    long n = 0;
+    for (std::size_t i = 0; i + 2 < data.size(); i += 3) {
+        n += data[i] == r && data[i + 1] == g && data[i + 2] == b;
+    }
+    return n;
+}
+
+constexpr int samples = 200;
+
+// 描画スレッドが寝てからproducerのスレッドでupdateを呼び、反映されるのを待ってから保存する
+void runCase(const XViewMap::ViewMapOptions& options,
+    const std::function<void(XViewMap::ViewMap&, int)>& update, const std::string& frame_path)
+{
+    XViewMap::ViewMap viewmap(options);
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    std::atomic<bool> done = false;
+    std::thread producer([&]() {
+        if (!forbidSyscalls()) {
+            std::perror("seccomp");
+            _exit(2);
+        }
+        counting = true;
+        for (int i = 0; i < samples; i++) {
+            update(viewmap, i);
+        }
+        counting = false;
+        done.store(true, std::memory_order_release);
+        // スレッドを終わらせるにもシステムコールが要るので、プロセスが終わるまで待つ
+        while (!never.load(std::memory_order_relaxed)) {
+        }
+    });
+    producer.detach();
+    while (!done.load(std::memory_order_acquire)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    if (!frame_path.empty() && viewmap.saveFrame(frame_path)) {
+        result->pos_pixels = countPixels(frame_path, 0xff, 0xa5, 0x00);
+        result->locus_pixels = countPixels(frame_path, 0x00, 0x00, 0xff);
+    }
+    // ViewMapを片付けずに終わる(producerのスレッドが残っている)
+    std::fflush(stdout);
+    _exit(0);
+}
+
+// 子プロセスで動かした結果
+struct Outcome {
+    int status;
+    long syscall_nr, allocations, pos_pixels, locus_pixels;
+};
+Outcome fork_case(const std::function<void()>& body)
+{
+    new (result) Result{{-1}, {0}, {-1}, {-1}};
+    std::fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        body();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return {status, result->syscall_nr.load(), result->allocations.load(),
+        result->pos_pixels.load(), result->locus_pixels.load()};
+}
+
+void updateBoth(XViewMap::ViewMap& viewmap, int i, bool rt)
+{
+    double t = i * 0.05;
+    double x = 1000 * std::cos(t), y = 1000 * std::sin(t);
+    if (rt) {
+        viewmap.updatePosRT(x, y, t, 0, 0, 0);
+        viewmap.updateLocusRT(x / 2, y / 2, t);
+    } else {
+        viewmap.updatePos(x, y, t, 0, 0, 0);
+        viewmap.updateLocus(x / 2, y / 2, t);
+    }
+}
+}  // namespace
+
+// glibcのmallocを呼ぶ前に、producerのスレッドの分を数える
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t n, std::size_t size);
+void* __libc_realloc(void* p, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+
+void* malloc(std::size_t size)
+{
+    if (counting) {
+        result->allocations++;
+    }
+    return __libc_malloc(size);
+}
+void* calloc(std::size_t n, std::size_t size)
+{
+    if (counting) {
+        result->allocations++;
+    }
+    return __libc_calloc(n, size);
+}
+void* realloc(void* p, std::size_t size)
+{
+    if (counting) {
+        result->allocations++;
+    }
+    return __libc_realloc(p, size);
+}
+void* aligned_alloc(std::size_t alignment, std::size_t size)
+{
+    if (counting) {
+        result->allocations++;
+    }
+    return __libc_memalign(alignment, size);
+}
+}
+
+int main()
+{
+    void* shared = mmap(
+        nullptr, sizeof(Result), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        std::perror("mmap");
+        return 1;
+    }
+    result = static_cast<Result*>(shared);
+    struct sigaction sa = {};
+    sa.sa_sigaction = onSigsys;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGSYS, &sa, nullptr);
+
+    XViewMap::ViewMapOptions options;
+    options.headless = true;
+    std::string frame_path = "rt_safety_" + std::to_string(getpid()) + ".ppm";
+    bool ok = true;
+
+    // rt_ingestなら、システムコールもメモリ確保もせず、寝ていた描画スレッドも反映する
+    {
+        XViewMap::ViewMapOptions rt = options;
+        rt.rt_ingest = true;
+        Outcome o = fork_case([&]() {
+            runCase(rt, [](XViewMap::ViewMap& v, int i) { updateBoth(v, i, true); }, frame_path);
+        });
+        bool pass = WIFEXITED(o.status) && WEXITSTATUS(o.status) == 0 && o.syscall_nr < 0
+                    && o.allocations == 0 && o.pos_pixels > 0 && o.locus_pixels > 0;
+        std::printf(
+            "rt_ingest: syscall %ld, allocations %ld, pos pixels %ld, locus pixels %ld: %s\n",
+            o.syscall_nr, o.allocations, o.pos_pixels, o.locus_pixels, pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    }
+    // out_of_processでも、共有メモリのリングに書くだけ
+    {
+        XViewMap::ViewMapOptions remote = options;
+        remote.rt_ingest = true;
+        remote.out_of_process = true;
+        Outcome o = fork_case([&]() {
+            runCase(remote, [](XViewMap::ViewMap& v, int i) { updateBoth(v, i, true); }, "");
+        });
+        bool pass = WIFEXITED(o.status) && WEXITSTATUS(o.status) == 0 && o.syscall_nr < 0
+                    && o.allocations == 0;
+        std::printf("out_of_process: syscall %ld, allocations %ld: %s\n", o.syscall_nr,
+            o.allocations, pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    }
+    // 確かめ方が効いているか: 描画スレッドを起こすupdatePosはシステムコールで止まる
+    {
+        Outcome o = fork_case([&]() {
+            runCase(options, [](XViewMap::ViewMap& v, int i) { updateBoth(v, i, false); }, "");
+        });
+        bool pass = o.syscall_nr >= 0;
+        std::printf("updatePos (expected to make a syscall): syscall %ld: %s\n", o.syscall_nr,
+            pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    }
+
+    std::remove(frame_path.c_str());
+    return ok ? 0 : 1;
+}